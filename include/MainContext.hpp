@@ -27,6 +27,9 @@ private:
     EventHandler eh;
     float move_amount;
     float move_speed = 20.0f;
+    // headless frames are traced in tiles that cover the crop rectangle
+    vk::Extent2D headless_frame_extent;
+    vk::Rect2D headless_crop;
 
     void dispatch_pressed_keys();
     void run_headless();
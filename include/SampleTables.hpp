@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace ve
+{
+    // must match SOBOL_DIMENSIONS and BLUE_NOISE_SIZE in sampler.glsl
+    constexpr uint32_t sobol_dimensions = 4;
+    constexpr uint32_t blue_noise_size = 64;
+
+    // 32 generator matrix columns per dimension, column i is xor-ed into the result if bit i of the sample index is set
+    std::vector<uint32_t> generate_sobol_matrices();
+    // tileable blue noise mask with uniformly distributed values in [0, 1), generated with void and cluster
+    std::vector<float> generate_blue_noise();
+} // namespace ve
@@ -20,6 +20,24 @@ public:
         float sensor_width;
         float focal_length;
         float exposure;
+        // termination of headless rendering before sample_count is reached, 0 disables them
+        float target_error = 0.0f;
+        float time_budget_seconds = 0.0f;
+        bool denoise = false;
+        // samples per pixel of one dispatch in headless mode
+        uint32_t samples_per_dispatch = 1;
+        // headless frames are traced in square tiles of this size, 0 traces the whole crop rectangle at once
+        uint32_t tile_size = 0;
+        // size of the headless frame, 0 uses the default size
+        uint32_t frame_width = 0;
+        uint32_t frame_height = 0;
+        // region of the frame that is traced and saved, a size of 0 covers the whole frame
+        uint32_t crop_x = 0;
+        uint32_t crop_y = 0;
+        uint32_t crop_width = 0;
+        uint32_t crop_height = 0;
+        // TONEMAP_CLAMP, TONEMAP_REINHARD or TONEMAP_ACES in tonemap.glsl
+        uint32_t tonemap_operator = 0;
 
         friend std::istream& operator>>(std::istream& is, Data& data);
         friend std::ostream& operator<<(std::ostream& os, const Data& data);
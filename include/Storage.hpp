@@ -89,6 +89,8 @@ namespace ve
         Image& get_image(uint32_t idx);
         Buffer& get_buffer_by_name(const std::string& name);
         Image& get_image_by_name(const std::string& name);
+        // buffers that are allocated lazily only exist once they were added and until they are destroyed
+        bool has_buffer(const std::string& name) const;
 
     private:
         const VulkanMainContext& vmc;
@@ -21,6 +21,8 @@ namespace ve
         Camera cam = Camera(60.0f, aspect_ratio);
         float time_diff = 0.000001f;
         float time = 0.0f;
+        // time of the keyframe animations in the scene, only advances while animate is set
+        float animation_time = 0.0f;
         int32_t current_scene = 0;
         uint32_t current_frame = 0;
         uint32_t total_frames = 0;
@@ -34,7 +36,43 @@ namespace ve
         bool path_depth_view = false;
         bool save_screenshot = false;
         bool accumulate_samples = true;
+        // keep the accumulated samples that are still visible when the camera moves instead of discarding all of them
+        bool reproject = true;
+        // set for the sample after a camera motion whose accumulated samples need to be reprojected
+        bool reproject_history = false;
         bool force_accumulate_samples = false;
+        // accumulate the colors as halfs, halves the memory and bandwidth of the accumulation at the cost of precision for long accumulations
+        bool half_precision_accumulation = false;
+        bool animate = true;
+        // split the path tracer into separate kernels that pass paths in queues instead of the megakernel
+        bool wavefront = false;
+        // source of the random decisions of the path tracer, SAMPLER_PCG, SAMPLER_SOBOL or SAMPLER_BLUE_NOISE in sampler.glsl
+        int32_t sampler = 1;
+        // relative standard error at which tiles stop receiving samples, 0 disables adaptive sampling
+        float adaptive_target_error = 0.0f;
+        uint32_t adaptive_min_samples = 16;
+        // samples per pixel that the megakernel traces in one dispatch, the samples are averaged before they are accumulated
+        uint32_t samples_per_dispatch = 1;
+        // tiles that were not converged in the last sample
+        uint32_t active_tile_count = 0;
+        // filter the displayed and saved image, the accumulated samples are not affected
+        bool denoise = false;
+        int32_t denoise_iterations = 5;
+        // operator that maps the accumulated samples to the displayed image, TONEMAP_CLAMP, TONEMAP_REINHARD or TONEMAP_ACES in tonemap.glsl
+        int32_t tonemap_operator = 0;
+        // trace at a reduced resolution while the camera or instances move and upscale it for display
+        bool dynamic_resolution = true;
+        // the resolution of a moving view is reduced until a dispatch of the path tracer takes at most this long on the gpu, in seconds
+        float frame_time_budget = 1.0f / 30.0f;
+        // fraction of the render extent per dimension that is traced, at most motion_resolution_scale while moving
+        float resolution_scale = 1.0f;
+        float motion_resolution_scale = 0.5f;
+        float min_resolution_scale = 0.25f;
+        // region in the top left of the render extent that is traced, smaller than it while the resolution is reduced
+        vk::Extent2D trace_extent = render_extent;
+        // the camera covers the frame, the traced region starts at the frame offset, they only differ from it for tiled rendering
+        vk::Extent2D frame_extent = render_extent;
+        vk::Offset2D frame_offset = vk::Offset2D(0, 0);
         bool vsync = true;
         bool headless = false;
     };
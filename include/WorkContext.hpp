@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <glm/mat4x4.hpp>
 #include <vector>
 
@@ -15,6 +16,8 @@
 #include "vk/PathTracer.hpp"
 #include "vk/Renderer.hpp"
 #include "vk/Histogram.hpp"
+#include "vk/Denoiser.hpp"
+#include "vk/Tonemapper.hpp"
 #include "vk/Synchronization.hpp"
 
 namespace ve
@@ -28,6 +31,8 @@ namespace ve
         void reload_shaders();
         void load_scene(const std::string& filename);
         void headless_next_sample(AppState& app_state);
+        // traces the last sample of the current region, denoised if enabled, and returns the rgba8 output image
+        std::vector<unsigned char> headless_last_sample(AppState& app_state);
         void draw_frame(AppState& app_state);
         vk::Extent2D recreate_swapchain(bool vsync);
 
@@ -39,15 +44,59 @@ namespace ve
         Scene scene;
         std::optional<UI> ui;
         std::vector<Synchronization> syncs;
+        // the path tracer runs on the compute queue independent of the frames, every submission signals its number on the compute timeline
+        // every frame signals its number on the display timeline, an output image is only written again once the frames that show it finished
+        std::optional<TimelineSemaphore> compute_timeline;
+        std::optional<TimelineSemaphore> display_timeline;
+        uint64_t compute_submission_count = 0;
+        uint64_t display_submission_count = 0;
+        // value of the display timeline of the last frame that showed each output image
+        std::array<uint64_t, display_image_count> image_display_values{};
+        // region of each output image that was traced by the submission that resolved it
+        std::array<vk::Extent2D, display_image_count> display_extents;
+        // grows while the compute queue runs dry between frames, so that cheap samples are not limited by the overhead of a submission
+        uint32_t dispatches_per_submission = 1;
+        // one timer per descriptor set of the path tracer, read back once the set is reused
+        std::vector<DeviceTimer> compute_timers;
+        struct TimedTrace
+        {
+            uint32_t dispatch_count = 1;
+            vk::Extent2D extent;
+        };
+        std::array<TimedTrace, frames_in_flight> timed_traces;
+        // measured gpu time of a single dispatch per traced pixel in seconds, 0 until the first measurement
+        double pixel_trace_time = 0.0;
+        // the histogram is read back when the next one is recorded, so only one of them is in flight
+        uint64_t histogram_submission = 0;
+        uint32_t histogram_sample_count = 0;
         std::vector<DeviceTimer> timers;
         PathTracer path_tracer;
+        Denoiser denoiser;
+        Tonemapper tonemapper;
         std::optional<Renderer> renderer;
         std::optional<Histogram> histogram;
-        uint32_t uniform_buffer;
+        // the camera of every descriptor set is written before its submission, so the host does not write a buffer in flight
+        std::vector<uint32_t> uniform_buffers;
+        std::vector<uint32_t> previous_uniform_buffers;
         Camera::Data old_cam_data;
+        // camera of the samples accumulated before the last camera movement
+        Camera::Data previous_cam_data;
+        bool instances_moved = false;
+        uint32_t headless_submission_count = 0;
+        std::array<bool, frames_in_flight> headless_cbs_recorded{};
+        float last_motion_time = -1.0f;
 
         void create_histogram_pipeline(uint32_t bin_count);
         void create_histogram_descriptor_set();
-        void render(uint32_t image_idx, uint32_t read_only_image, AppState& app_state);
+        uint32_t submit_headless_sample(AppState& app_state, bool last_sample);
+        // traces a batch of samples and resolves them into the next output image, update_scene records the animation of the instances
+        void submit_sample(AppState& app_state, bool update_scene);
+        // waits until no submission uses the shared buffers and descriptor sets anymore
+        void wait_for_compute() const;
+        bool update_trace_extent(AppState& app_state, bool moving);
+        // writes the output image of the path tracer from its accumulated samples, only needed when it is shown or saved
+        void resolve_image(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx);
+        // shows the output image of the given compute submission, which has to be finished
+        void render(uint32_t image_idx, uint64_t shown_submission, AppState& app_state);
     };
 } // namespace ve
@@ -39,6 +39,8 @@ namespace ve
 
         void destruct()
         {
+            if (persistent_mapping) vmaUnmapMemory(vmc.va, vmaa);
+            persistent_mapping = nullptr;
             vmaDestroyBuffer(vmc.va, buffer, vmaa);
         }
 
@@ -63,22 +65,8 @@ namespace ve
 
             if (device_local)
             {
-                auto [staging_buffer, staging_vmaa] = create_buffer((vk::BufferUsageFlagBits::eTransferSrc), VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, true, {vmc.queue_family_indices.transfer});
-                void* mapped_mem;
-                vmaMapMemory(vmc.va, staging_vmaa, &mapped_mem);
-                memset(mapped_mem, constant, byte_count);
-                vmaUnmapMemory(vmc.va, staging_vmaa);
-
-                vk::CommandBuffer& cb = vcc.get_one_time_transfer_buffer();
-
-                vk::BufferCopy copy_region{};
-                copy_region.srcOffset = 0;
-                copy_region.dstOffset = 0;
-                copy_region.size = byte_count;
-                cb.copyBuffer(staging_buffer, buffer, copy_region);
-                vcc.submit_transfer(cb, true);
-
-                vmaDestroyBuffer(vmc.va, staging_buffer, staging_vmaa);
+                // recorded into the pending uploads, later submissions through vcc wait for them
+                vcc.fill_buffer(buffer, 0, constant, byte_count);
             }
             else
             {
@@ -95,22 +83,8 @@ namespace ve
 
             if (device_local)
             {
-                auto [staging_buffer, staging_vmaa] = create_buffer((vk::BufferUsageFlagBits::eTransferSrc), VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, true, {vmc.queue_family_indices.transfer});
-                void* mapped_mem;
-                vmaMapMemory(vmc.va, staging_vmaa, &mapped_mem);
-                memcpy(mapped_mem, data, byte_count);
-                vmaUnmapMemory(vmc.va, staging_vmaa);
-
-                vk::CommandBuffer& cb = vcc.get_one_time_transfer_buffer();
-
-                vk::BufferCopy copy_region{};
-                copy_region.srcOffset = 0;
-                copy_region.dstOffset = 0;
-                copy_region.size = byte_count;
-                cb.copyBuffer(staging_buffer, buffer, copy_region);
-                vcc.submit_transfer(cb, true);
-
-                vmaDestroyBuffer(vmc.va, staging_buffer, staging_vmaa);
+                // recorded into the pending uploads, later submissions through vcc wait for them
+                vcc.upload_buffer(buffer, 0, data, byte_count);
             }
             else
             {
@@ -202,6 +176,20 @@ namespace ve
             return data;
         }
 
+        // map the buffer once and keep it mapped until it is destroyed, for host visible data that changes every frame
+        void* get_persistent_mapping()
+        {
+            VE_ASSERT(!device_local, "Cannot map device local buffer!");
+            if (!persistent_mapping) vmaMapMemory(vmc.va, vmaa, &persistent_mapping);
+            return persistent_mapping;
+        }
+
+        // make writes through the persistent mapping visible to the device, does nothing for host coherent memory
+        void flush(std::size_t byte_count)
+        {
+            vmaFlushAllocation(vmc.va, vmaa, 0, byte_count);
+        }
+
         vk::DeviceAddress get_device_address()
         {
             vk::BufferDeviceAddressInfoKHR buffer_device_adress_i{};
@@ -238,6 +226,7 @@ namespace ve
         bool device_local;
         uint64_t byte_size;
         uint64_t element_count;
+        void* persistent_mapping = nullptr;
         vk::Buffer buffer;
         VmaAllocation vmaa;
     };
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vk/Pipeline.hpp"
+#include "vk/DescriptorSetHandler.hpp"
+#include "Storage.hpp"
+#include "UI.hpp"
+
+namespace ve
+{
+    // edge avoiding a-trous wavelet filter guided by the albedo and normal AOVs and the variance of the path tracer
+    // overwrites the output image of the path tracer, the accumulated samples stay untouched
+    class Denoiser
+    {
+    public:
+        Denoiser(const VulkanMainContext& vmc, Storage& storage);
+        void setup_storage(AppState& app_state);
+        void construct();
+        void destruct();
+        void reload_shaders();
+        // returns whether the output image was written, the debug views are not denoised and left to the tonemapper
+        bool compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx);
+        // binds the buffers of the path tracer again after it replaced them
+        void update_descriptors();
+    private:
+        const VulkanMainContext& vmc;
+        Storage& storage;
+        Pipeline pipeline;
+        DescriptorSetHandler dsh;
+        uint32_t denoise_buffer;
+
+        struct DenoisePushConstants
+        {
+            uint32_t iteration = 0;
+            uint32_t iteration_count = 0;
+            float exposure = 1.0f;
+            uint32_t tonemap_operator = 0;
+            uint32_t viewport_width = 0;
+            uint32_t viewport_height = 0;
+            uint32_t half_precision_accumulation = 0;
+        } dpc;
+
+        void create_pipeline();
+        void create_descriptor_set();
+        void add_descriptors();
+    };
+} // namespace ve
@@ -12,7 +12,8 @@ namespace ve
     public:
         DescriptorSetHandler(const VulkanMainContext& vmc, uint32_t set_count);
         // first, describe the whole layout of the descriptor set
-        void add_binding(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count = 1);
+        // bindings with ePartiallyBound do not need all descriptor_count descriptors to be added
+        void add_binding(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count = 1, vk::DescriptorBindingFlags binding_flags = {});
         // second, add the descriptors to each set
         void add_descriptor(uint32_t set, uint32_t binding, const std::vector<Image>& images);
         void add_descriptor(uint32_t set, uint32_t binding, const Image& image);
@@ -20,18 +21,22 @@ namespace ve
         void add_descriptor(uint32_t set, uint32_t binding, const Buffer& buffer);
         // third, construct the descriptor set
         void construct();
+        // remove all descriptors but keep the layout and the sets, add new descriptors and call update() to rewrite the sets
+        void reset_descriptors();
+        void update();
         void destruct();
         const std::vector<vk::DescriptorSetLayout>& get_layouts() const;
         const std::vector<vk::DescriptorSet>& get_sets() const;
 
     private:
         struct Descriptor {
-            Descriptor(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count, uint32_t set_count) : dslb(binding, type, descriptor_count, stages), dbi(set_count), dii(set_count), pNext(set_count)
+            Descriptor(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count, vk::DescriptorBindingFlags binding_flags, uint32_t set_count) : dslb(binding, type, descriptor_count, stages), binding_flags(binding_flags), dbi(set_count), dii(set_count), pNext(set_count)
             {}
             std::vector<std::vector<vk::DescriptorBufferInfo>> dbi;
             std::vector<std::vector<vk::DescriptorImageInfo>> dii;
             std::vector<void*> pNext;
             vk::DescriptorSetLayoutBinding dslb;
+            vk::DescriptorBindingFlags binding_flags;
         };
 
         const VulkanMainContext& vmc;
@@ -14,7 +14,7 @@ namespace ve
         void setup_storage(AppState& app_state);
         void construct(AppState& app_state);
         void destruct();
-        void compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image);
+        void compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx);
     private:
         const VulkanMainContext& vmc;
         Storage& storage;
@@ -8,6 +8,8 @@ namespace ve
     void blit_image(vk::CommandBuffer& cb, vk::Image& src, uint32_t src_mip_map_lvl, vk::Offset3D src_offset, vk::Image& dst, uint32_t dst_mip_map_lvl, vk::Offset3D dst_offset, uint32_t layer_count);
     void copy_image(vk::CommandBuffer& cb, vk::Image& src, vk::Image& dst, uint32_t width, uint32_t height, uint32_t layer_count);
     void perform_image_layout_transition(vk::CommandBuffer& cb, vk::Image image, vk::ImageLayout old_layout, vk::ImageLayout new_layout, vk::PipelineStageFlags src_stage_flags, vk::PipelineStageFlags dst_stage_flags, vk::AccessFlags src_access_flags, vk::AccessFlags dst_access_flags, uint32_t base_mip_level, uint32_t mip_levels, uint32_t layer_count);
+    // writes rgba8 data to a png in the images directory that is named after the current time
+    void save_png(const std::vector<unsigned char>& data, uint32_t width, uint32_t height);
 
     class Image
     {
@@ -24,6 +26,10 @@ namespace ve
         void destruct();
         void transition_image_layout(VulkanCommandContext& vcc, vk::ImageLayout new_layout, vk::PipelineStageFlags src_stage_flags, vk::PipelineStageFlags dst_stage_flags, vk::AccessFlags src_access_flags, vk::AccessFlags dst_access_flags);
         void save_to_file(VulkanCommandContext& vcc);
+        // only saves the top left region of the given size
+        void save_to_file(VulkanCommandContext& vcc, vk::Extent2D region);
+        // rgba8 data of the first layer, rows in the order of the image
+        std::vector<unsigned char> obtain_data(VulkanCommandContext& vcc);
         vk::DeviceSize get_byte_size() const;
         uint32_t get_layer_count() const;
         vk::ImageLayout get_layout() const;
@@ -14,6 +14,12 @@ namespace ve
         int32_t material_idx;
         uint32_t index_offset;
         uint32_t index_count;
+        uint32_t vertex_offset = 0;
+        uint32_t vertex_count = 0;
+        // colors are only stored on the gpu for meshes that have vertex colors
+        bool vertex_colors = false;
+        // index of the first color of this mesh in the color buffer of the scene (-1 = no colors)
+        int32_t color_offset = -1;
         std::string name;
     };
 } // namespace ve
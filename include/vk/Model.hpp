@@ -36,22 +36,40 @@ namespace ve
         float outerConeAngle;
     };
 
-    struct Model
+    // decoded rgba8 pixels of a texture, images are created from this by the scene
+    struct TextureData
     {
-        void apply_transformation(const glm::mat4& transformation);
+        std::vector<unsigned char> pixels;
+        uint32_t width;
+        uint32_t height;
+        uint32_t base_mip_level;
+    };
 
+    // reference of a node to a mesh group together with the accumulated transformation of the node
+    struct MeshInstance
+    {
+        uint32_t mesh_group_idx;
+        glm::mat4 transformation;
+    };
+
+    struct Model
+    {
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
         std::vector<Material> materials;
         std::vector<Light> lights;
-        std::vector<Mesh> meshes;
-        std::vector<uint32_t> texture_image_indices;
+        // every glTF mesh is stored once as a group of meshes (one per primitive) in object space, regardless of how many nodes reference it
+        std::vector<std::vector<Mesh>> mesh_groups;
+        std::vector<MeshInstance> mesh_instances;
+        std::vector<TextureData> textures;
     };
 
+    // the loader does not keep any state between calls, so models can be loaded concurrently
+    // all returned indices (vertex indices, index offsets, material and texture indices) are relative to the returned model
     namespace ModelLoader
     {
-        void reset();
-        Model load(const VulkanMainContext& vmc, Storage& storage, const nlohmann::json& model);
-        Model load_custom(const VulkanMainContext& vmc, Storage& storage, const nlohmann::json& model);
+        Model load(const nlohmann::json& model);
+        Model load_custom(const nlohmann::json& model);
+        int32_t load_json_material(const nlohmann::json& model, Model& model_data);
     };
 } // namespace ve
@@ -12,29 +12,51 @@ namespace ve
         vk::AccelerationStructureKHR handle;
         uint64_t deviceAddress = 0;
         uint32_t buffer;
-        uint32_t scratch_buffer;
     };
 
     class PathTraceBuilder
     {
     public:
+        static constexpr uint32_t no_blas = uint32_t(-1);
+
         PathTraceBuilder(const VulkanMainContext& vmc, VulkanCommandContext& vcc, Storage& storage);
         void destruct();
-        uint32_t add_blas(vk::CommandBuffer& cb, uint32_t vertex_buffer_id, uint32_t index_buffer_id, const std::vector<uint32_t>& index_offsets, const std::vector<uint32_t>& index_counts, vk::DeviceSize vertex_stride);
+        // blas are only recorded here and built all together in build_blas()
+        uint32_t add_blas(uint32_t vertex_buffer_id, uint32_t index_buffer_id, const std::vector<uint32_t>& index_offsets, const std::vector<uint32_t>& index_counts, vk::DeviceSize vertex_stride);
+        // build all recorded blas in batches sharing one scratch buffer and compact them afterwards
+        void build_blas();
+        // instances of mesh groups without geometry pass no_blas, they keep their index for update_instance() but are inactive
         uint32_t add_instance(uint32_t blas_idx, const glm::mat4& M, uint32_t custom_index);
+        // only changes the host side copy of the instance, update_tlas() uploads it
         void update_instance(uint32_t instance_idx, const glm::mat4& M);
         void create_tlas(vk::CommandBuffer& cb);
+        // upload all instances and refit the tlas to their new transformations, regularly falls back to a full rebuild
+        // every descriptor set has its own instance buffer, so the host does not write the instances of a submission in flight
+        void update_tlas(vk::CommandBuffer& cb, uint32_t read_only_image);
 
     private:
+        struct BlasGeometry {
+            std::vector<vk::AccelerationStructureGeometryKHR> asgs;
+            std::vector<vk::AccelerationStructureBuildRangeInfoKHR> asbris;
+        };
+
         const VulkanMainContext& vmc;
         VulkanCommandContext& vcc;
         Storage& storage;
         vk::WriteDescriptorSetAccelerationStructureKHR wdsas;
         std::vector<AccelerationStructure> bottomLevelAS;
+        std::vector<BlasGeometry> pending_blas;
         std::vector<vk::AccelerationStructureInstanceKHR> instances;
-        uint32_t instances_buffer;
+        std::vector<uint32_t> instances_buffers;
         AccelerationStructure topLevelAS;
+        uint32_t tlas_scratch_buffer;
+        std::vector<void*> instances_mappings;
+        vk::AccelerationStructureGeometryKHR tlas_geometry;
+        uint32_t tlas_refit_count = 0;
 
-        void create_blas(vk::CommandBuffer& cb, uint32_t vertex_buffer_id, uint32_t index_buffer_id, const std::vector<uint32_t>& index_offsets, const std::vector<uint32_t>& index_counts, vk::DeviceSize vertex_stride, AccelerationStructure& blas);
+        AccelerationStructure create_blas(vk::DeviceSize size);
+        void destroy_acceleration_structure(AccelerationStructure& as);
+        void write_instances(uint32_t read_only_image);
+        void record_tlas_build(vk::CommandBuffer& cb, vk::BuildAccelerationStructureModeKHR mode);
     };
 } // namespace ve
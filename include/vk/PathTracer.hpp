@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 #include "vk/Pipeline.hpp"
 #include "vk/DescriptorSetHandler.hpp"
 #include "Storage.hpp"
@@ -15,30 +17,109 @@ namespace ve
         void construct(VulkanCommandContext& vcc);
         void destruct();
         void reload_shaders();
-        void set_scene(uint32_t scene_texture_image_count, bool init);
-        void compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image);
+        // the pipeline serves all scenes, switching scenes only rewrites the descriptors
+        void set_scene(uint32_t scene_texture_image_count, uint32_t emissive_triangle_count, uint32_t punctual_light_count, bool init);
+        // a sample is split into the host side updates and the recording of its commands
+        // as long as the settings do not change, recorded commands can be submitted again after calling prepare_sample() with the same descriptor set
+        void prepare_sample(AppState& app_state, uint32_t read_only_image);
+        // records dispatch_count consecutive dispatches, each of them adds get_samples_per_pixel() samples
+        void record_sample(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image, uint32_t dispatch_count = 1);
+        // whether the commands recorded with this descriptor set are outdated, as the wavefront mode records more bounces now
+        bool needs_recording(uint32_t read_only_image) const;
+        // whether the next sample allocates buffers and updates the descriptor sets, which requires that no submission uses them
+        bool needs_storage_update(const AppState& app_state) const;
+        // adds the path depth buffer once its view is used and reallocates the accumulation buffer if its precision changed
+        // returns whether the passes that read the accumulated samples have to bind the buffers again
+        bool update_accumulation_buffers(AppState& app_state);
+        // storage indices of the output images that the accumulated samples are resolved to
+        const std::vector<uint32_t>& get_images() const;
+        // samples per pixel that were added by the last prepared sample
+        uint32_t get_samples_per_pixel() const;
     private:
+        // kernels of the wavefront mode, paths are passed between them in compacted queues
+        enum WavefrontKernel {
+            WAVEFRONT_PREPARE = 0,
+            WAVEFRONT_GENERATE,
+            WAVEFRONT_EXTEND,
+            WAVEFRONT_SHADE,
+            WAVEFRONT_CONNECT,
+            WAVEFRONT_FINALIZE,
+            WAVEFRONT_KERNEL_COUNT
+        };
+
+        // in order of their bindings, starting at binding 21
+        enum WavefrontBuffer {
+            WAVEFRONT_PATH_STATES = 0,
+            WAVEFRONT_HITS,
+            WAVEFRONT_RAY_QUEUES,
+            WAVEFRONT_SHADOW_RAYS,
+            WAVEFRONT_COUNTERS,
+            WAVEFRONT_BUFFER_COUNT
+        };
+
         const VulkanMainContext& vmc;
         Storage& storage;
         Pipeline pipeline;
+        Pipeline adaptive_mask_pipeline;
+        Pipeline reproject_pipeline;
+        std::vector<Pipeline> wavefront_pipelines;
         DescriptorSetHandler dsh;
         std::vector<uint32_t> path_trace_images;
-        std::vector<uint32_t> path_trace_buffers;
+        // accumulated colors of all pixels, updated in place by every sample
+        uint32_t accumulation_buffer;
+        // accumulated path depth, only allocated once the path depth view is used
         std::vector<uint32_t> path_depth_buffers;
+        // the state of a path per pixel needs a lot of memory, so it is only allocated once the wavefront mode is selected
+        std::vector<uint32_t> wavefront_buffers;
+        // sobol generator matrices and blue noise mask, generated once on startup
+        std::vector<uint32_t> sample_table_buffers;
+        // per pixel sample statistics, per tile convergence mask and the host visible counts of tiles that are not converged per descriptor set
+        std::vector<uint32_t> adaptive_buffers;
+        std::vector<uint32_t> sample_index_buffers;
+        // host visible number of bounces the wavefront paths needed per descriptor set
+        std::vector<uint32_t> bounce_count_buffers;
+        // bounces recorded by the wavefront mode, grows with the paths of the scene as cutting them short biases the image
+        uint32_t wavefront_bounce_cap;
+        std::array<uint32_t, frames_in_flight> recorded_bounce_caps{};
+        uint32_t aov_buffer;
+        // the reprojected history of every pixel, only allocated once the camera moves with reprojection enabled
+        std::vector<uint32_t> reprojection_buffers;
 
         uint32_t scene_texture_count;
 
         struct PathTracerPushConstants
         {
-            uint32_t sample_count = 0;
+            uint32_t samples_per_pixel = 1;
             uint32_t attenuation_view = 0;
             uint32_t emission_view = 0;
             uint32_t normal_view = 0;
             uint32_t tex_view = 0;
             uint32_t path_depth_view = 0;
+            uint32_t emissive_triangle_count = 0;
+            uint32_t punctual_light_count = 0;
+            uint32_t bounce = 0;
+            uint32_t kernel_pass = 0;
+            uint32_t sampler = 0;
+            float adaptive_target_error = 0.0f;
+            uint32_t adaptive_min_samples = 0;
+            uint32_t viewport_width = 0;
+            uint32_t viewport_height = 0;
+            int32_t frame_offset_x = 0;
+            int32_t frame_offset_y = 0;
+            uint32_t frame_width = 0;
+            uint32_t frame_height = 0;
+            uint32_t half_precision_accumulation = 0;
+            uint32_t dispatch_sample_offset = 0;
         } ptpc;
 
+        void setup_wavefront_storage(const AppState& app_state);
+        void compute_wavefront(vk::CommandBuffer& cb, const AppState& app_state);
+        bool is_debug_view() const;
+        void add_accumulation_buffer(const AppState& app_state);
+        void compute_adaptive_mask(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image);
+        void compute_reprojection(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image);
         void create_pipeline();
         void create_descriptor_set();
+        void add_descriptors();
     };
 } // namespace ve
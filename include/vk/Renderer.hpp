@@ -11,16 +11,24 @@ namespace ve
     {
     public:
         Renderer(const VulkanMainContext& vmc, Storage& storage);
-        void setup_storage(AppState& app_state);
-        void construct(const RenderPass& render_pass);
+        // samples the given output images of the path tracer without copying them
+        void construct(const RenderPass& render_pass, const std::vector<uint32_t>& path_trace_image_indices);
         void destruct();
-        void render(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image, const vk::Framebuffer& framebuffer, const vk::RenderPass& render_pass);
+        // the submission has to wait for the compute submission that wrote the image, the images are shared concurrently between the queue families
+        // traced_extent is the region of the path trace image that holds the image, it is upscaled to the window if it is smaller than the render extent
+        void render(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx, vk::Extent2D traced_extent, const vk::Framebuffer& framebuffer, const vk::RenderPass& render_pass);
     private:
         const VulkanMainContext& vmc;
         Storage& storage;
         Pipeline pipeline;
         DescriptorSetHandler dsh;
-        std::vector<uint32_t> render_textures;
+        std::vector<uint32_t> path_trace_images;
+
+        struct RendererPushConstants
+        {
+            uint32_t traced_width = 0;
+            uint32_t traced_height = 0;
+        } rpc;
 
         void create_pipeline(const RenderPass& render_pass);
         void create_descriptor_set();
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <glm/gtc/quaternion.hpp>
 #include "vk/Model.hpp"
+#include "vk/SceneCache.hpp"
 #include "Storage.hpp"
 #include "Timer.hpp"
 #include "vk/PathTraceBuilder.hpp"
@@ -15,6 +18,13 @@ namespace ve
         void destruct();
         void load(const std::string& path);
         uint32_t get_texture_image_count() const;
+        uint32_t get_emissive_triangle_count() const;
+        uint32_t get_punctual_light_count() const;
+        // move the animated model references to the given time and refit the tlas, returns false if nothing moved
+        // the instances and transformations are written to the buffers of the descriptor set, the other set may still be in use
+        bool update(vk::CommandBuffer& cb, float time, uint32_t read_only_image);
+        // the tlas is shared, so the transformations of a set are brought up to date before it is used again
+        void update_transforms(uint32_t read_only_image);
 
         bool loaded = false;
 
@@ -23,22 +33,108 @@ namespace ve
             int32_t mat_idx;
             uint32_t indices_idx;
             uint32_t idx_count;
+            uint32_t model_idx;
+            int32_t color_offset;
+            uint32_t vertex_offset;
+            // first entry of the mesh in the emissive triangles, -1 if it does not emit light
+            int32_t emissive_triangle_offset = -1;
         };
 
+        // compact vertex attributes, positions are stored in a separate stream that is also used for the acceleration structure build
+        struct VertexAttributes {
+            // octahedral encoded normal as snorm16x2
+            uint32_t normal;
+            // texture coordinates as half2
+            uint32_t tex;
+        };
+
+        // emissive triangle together with its entry of the alias table that picks triangles proportional to their power
+        struct EmissiveTriangle {
+            // geometric normal and area in object space of the referencing model
+            glm::vec3 normal;
+            float area;
+            uint32_t mesh_render_data_idx;
+            uint32_t primitive_idx;
+            float probability;
+            // an entry chosen uniformly is replaced by its alias if a second random number exceeds the threshold
+            float alias_threshold;
+            uint32_t alias;
+            uint32_t padding[3];
+        };
+
+        // node of the light tree that picks punctual lights by their estimated contribution at the shading point
+        struct LightTreeNode {
+            glm::vec3 bounds_min;
+            float power;
+            glm::vec3 bounds_max;
+            // spread of the light directions around the axis
+            float theta_o;
+            glm::vec3 axis;
+            // emission angle around each light direction
+            float theta_e;
+            // inner nodes store their left child, the right child directly follows it, leaves store their light
+            uint32_t child_or_light;
+            uint32_t leaf;
+            uint32_t padding[2];
+        };
+
+        struct ModelTransform {
+            glm::mat4 object_to_world;
+            glm::mat4 normal_to_world;
+        };
+
+        // one mesh of a mesh group, all meshes of a group share one blas
+        struct GroupMesh {
+            uint32_t mesh_group_idx;
+            uint32_t index_offset;
+            uint32_t index_count;
+        };
+
+        // one instance in the tlas
         struct ModelInfo {
-            std::vector<uint32_t> mesh_index_offsets;
-            std::vector<uint32_t> mesh_index_count;
-            uint32_t index_buffer_idx;
-            uint32_t num_indices;
-            uint32_t blas_idx;
-            uint32_t instance_idx;
+            glm::mat4 transformation;
+            uint32_t mesh_group_idx;
             uint32_t mesh_render_data_idx;
         };
 
+        struct TextureInfo {
+            uint32_t width;
+            uint32_t height;
+            uint32_t base_mip_level;
+            // written to the cache file, so the alignment of data_offset must not leave uninitialized bytes
+            uint32_t padding = 0;
+            uint64_t data_offset;
+        };
+
+        // instances created by one entry of model_files
+        struct ModelReference {
+            uint32_t first_model_info;
+            uint32_t model_info_count;
+        };
+
+        struct Keyframe {
+            float time;
+            glm::vec3 scale;
+            glm::quat rotation;
+            glm::vec3 translation;
+        };
+
+        // keyframed transformation of one model reference
+        struct Animation {
+            std::vector<Keyframe> keyframes;
+            bool loop;
+            float current_time;
+            uint32_t first_model_info;
+            // transformations of the instances relative to the model reference
+            std::vector<glm::mat4> local_transformations;
+        };
+
         const VulkanMainContext& vmc;
         VulkanCommandContext& vcc;
         Storage& storage;
-        uint32_t vertex_buffer;
+        uint32_t vertex_position_buffer;
+        uint32_t vertex_attribute_buffer;
+        uint32_t vertex_color_buffer;
         uint32_t index_buffer;
         // use -1 to encode missing material buffer and/or textures as they are not required
         int32_t material_buffer = -1;
@@ -46,7 +142,23 @@ namespace ve
         int32_t light_buffer = -1;
         uint32_t mesh_render_data_buffer;
         uint32_t model_mrd_indices_buffer;
-        uint32_t emissive_mesh_indices_buffer;
+        uint32_t emissive_triangle_buffer;
+        uint32_t emissive_triangle_count = 0;
+        uint32_t light_tree_buffer;
+        uint32_t punctual_light_count = 0;
+        // one buffer per descriptor set, the version counts the animation updates the buffer contains
+        std::vector<uint32_t> model_transforms_buffers;
+        std::vector<ModelTransform> model_transforms;
+        uint64_t transforms_version = 0;
+        std::array<uint64_t, frames_in_flight> buffer_transforms_versions{};
+        std::vector<Animation> animations;
         PathTraceBuilder path_tracer;
+
+        void build_cache(const nlohmann::json& data, SceneCache& cache);
+        static void build_light_tree(std::vector<LightTreeNode>& nodes, uint32_t node_idx, const std::vector<Light>& lights, std::span<uint32_t> light_indices);
+        void load_animations(const nlohmann::json& data, const SceneCache& cache);
+        void upload(const SceneCache& cache);
+        // returns true if any instance got a new transformation
+        bool apply_animations(float time);
     };
 } // namespace ve
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace ve
+{
+    // binary file containing the fully preprocessed data of a scene
+    // sections are stored 16 byte aligned so that they can be used directly from the memory mapping
+    class SceneCache
+    {
+    public:
+        enum Section : uint32_t {
+            VERTEX_POSITIONS = 0,
+            VERTEX_ATTRIBUTES,
+            VERTEX_COLORS,
+            INDICES,
+            MATERIALS,
+            LIGHTS,
+            MESH_RENDER_DATA,
+            EMISSIVE_TRIANGLES,
+            GROUP_MESHES,
+            MODEL_INFOS,
+            TEXTURE_INFOS,
+            TEXTURE_DATA,
+            MODEL_REFERENCES,
+            LIGHT_TREE,
+            SECTION_COUNT
+        };
+
+        SceneCache() = default;
+        SceneCache(const SceneCache&) = delete;
+        SceneCache& operator=(const SceneCache&) = delete;
+        ~SceneCache();
+
+        // hash over the scene description and the size and modification time of all assets it references
+        static uint64_t compute_hash(const std::string& scene_file_content, const nlohmann::json& scene);
+        // map an existing cache file, fails if the file is missing, has an outdated version or belongs to a different hash
+        bool open(const std::string& path, uint64_t hash);
+        // start building a new cache in memory
+        void begin(uint64_t hash);
+        void add_section(Section section, const void* data, std::size_t byte_size);
+        template<typename T>
+        void add_section(Section section, const std::vector<T>& data)
+        {
+            add_section(section, data.data(), data.size() * sizeof(T));
+        }
+        bool write(const std::string& path) const;
+        void close();
+
+        template<typename T>
+        std::span<const T> get_section(Section section) const
+        {
+            const Header* header = reinterpret_cast<const Header*>(get_data());
+            return std::span<const T>(reinterpret_cast<const T*>(get_data() + header->sections[section].offset), header->sections[section].byte_size / sizeof(T));
+        }
+
+    private:
+        // increment whenever the layout of the file or of any stored struct changes
+        static constexpr uint32_t version = 6;
+        static constexpr uint64_t magic = 0x4548434143445000; // "\0PDCACHE"
+
+        struct SectionInfo {
+            uint64_t offset;
+            uint64_t byte_size;
+        };
+
+        struct Header {
+            uint64_t magic;
+            uint32_t version;
+            uint32_t section_count;
+            uint64_t hash;
+            SectionInfo sections[SECTION_COUNT];
+        };
+
+        std::vector<std::byte> memory;
+        void* mapping = nullptr;
+        std::size_t mapping_size = 0;
+
+        const std::byte* get_data() const;
+    };
+} // namespace ve
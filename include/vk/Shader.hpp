@@ -1,5 +1,7 @@
 #pragma once
 
+#include <filesystem>
+
 #include "common.hpp"
 
 namespace ve
@@ -25,6 +27,7 @@ namespace ve
         vk::ShaderModule shader_module;
         vk::PipelineShaderStageCreateInfo pssci;
 
+        bool is_up_to_date(const std::filesystem::path& bin_file, const std::filesystem::path& hash_file, uint64_t hash, const std::vector<std::filesystem::path>& sources);
         std::string read_shader_file(const std::string& filename);
     };
 } // namespace ve
@@ -33,4 +33,20 @@ namespace ve
         std::vector<vk::Semaphore> semaphores;
         std::vector<vk::Fence> fences;
     };
+
+    // counts the finished submissions of a queue, so that other queues and the host can wait for any of them without a fence per submission
+    class TimelineSemaphore
+    {
+    public:
+        TimelineSemaphore(const vk::Device& logical_device);
+        void destruct();
+        const vk::Semaphore& get() const;
+        // value of the last finished submission that signals the semaphore
+        uint64_t get_value() const;
+        void wait(uint64_t value) const;
+
+    private:
+        const vk::Device& device;
+        vk::Semaphore semaphore;
+    };
 } // namespace ve
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vk/Pipeline.hpp"
+#include "vk/DescriptorSetHandler.hpp"
+#include "Storage.hpp"
+#include "UI.hpp"
+
+namespace ve
+{
+    // resolves the accumulated samples of the path tracer to its rgba8 output image
+    // only recorded when the image is shown, saved or read by the histogram, the path tracer itself never writes it
+    class Tonemapper
+    {
+    public:
+        Tonemapper(const VulkanMainContext& vmc, Storage& storage);
+        void construct();
+        void destruct();
+        void reload_shaders();
+        void compute(vk::CommandBuffer& cb, const AppState& app_state, uint32_t image_idx);
+        // binds the buffers of the path tracer again after it replaced or added them
+        void update_descriptors();
+    private:
+        const VulkanMainContext& vmc;
+        Storage& storage;
+        Pipeline pipeline;
+        DescriptorSetHandler dsh;
+
+        struct TonemapPushConstants
+        {
+            float exposure = 1.0f;
+            uint32_t tonemap_operator = 0;
+            uint32_t viewport_width = 0;
+            uint32_t viewport_height = 0;
+            uint32_t half_precision_accumulation = 0;
+            uint32_t path_depth_view = 0;
+        } tpc;
+
+        void create_pipeline();
+        void create_descriptor_set();
+        void add_descriptors();
+    };
+} // namespace ve
@@ -17,10 +17,37 @@ namespace ve
         vk::CommandBuffer& get_one_time_graphics_buffer();
         vk::CommandBuffer& get_one_time_compute_buffer();
         vk::CommandBuffer& get_one_time_transfer_buffer();
-        vk::CommandBuffer& begin(vk::CommandBuffer& cb);
-        void submit_graphics(const vk::CommandBuffer& cb, bool wait_idle) const;
-        void submit_compute(const vk::CommandBuffer& cb, bool wait_idle) const;
-        void submit_transfer(const vk::CommandBuffer& cb, bool wait_idle) const;
+        // command buffers that are submitted several times have to be recorded without eOneTimeSubmit
+        vk::CommandBuffer& begin(vk::CommandBuffer& cb, vk::CommandBufferUsageFlags flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        // all submissions first flush the pending uploads and wait for them on the gpu
+        void submit_graphics(const vk::CommandBuffer& cb, bool wait_idle);
+        void submit_compute(const vk::CommandBuffer& cb, bool wait_idle);
+        void submit_transfer(const vk::CommandBuffer& cb, bool wait_idle);
+
+        // uploads are staged in a persistently mapped ring buffer and recorded into one transfer command buffer
+        // they are submitted together by flush_uploads() which signals the upload timeline semaphore
+        struct StagingAllocation {
+            vk::Buffer buffer;
+            vk::DeviceSize offset;
+            void* data;
+        };
+        // byte_size must not exceed staging_chunk_size
+        StagingAllocation allocate_staging(vk::DeviceSize byte_size);
+        vk::CommandBuffer& get_upload_buffer();
+        void upload_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize byte_size);
+        void fill_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, int constant, vk::DeviceSize byte_size);
+        // returns the value of the upload timeline semaphore that is signaled once all uploads recorded so far finished
+        uint64_t flush_uploads();
+        void wait_for_uploads();
+
+        // graphics work of many resources, e.g. the mip maps of all scene textures, is recorded into one command buffer
+        // it is submitted once by flush_graphics_batch() or before any other submission, both wait until it finished
+        vk::CommandBuffer& get_graphics_batch_buffer();
+        // resources that are only read by the recorded batch are destroyed after it finished
+        void destroy_after_graphics_batch(vk::Image image, VmaAllocation vmaa);
+        void flush_graphics_batch();
+
+        static constexpr vk::DeviceSize staging_chunk_size = 16 * 1024 * 1024;
 
         const VulkanMainContext& vmc;
         std::vector<CommandPool> command_pools;
@@ -28,6 +55,7 @@ namespace ve
         std::vector<vk::CommandBuffer> compute_cbs;
         std::vector<vk::CommandBuffer> transfer_cbs;
         std::vector<vk::CommandBuffer> one_time_cbs;
+        vk::Semaphore upload_semaphore;
 
     private:
         enum Type
@@ -38,6 +66,26 @@ namespace ve
             TYPE_COUNT
         };
 
-        void submit(const vk::CommandBuffer& cb, const vk::Queue& queue, bool wait_idle) const;
+        static constexpr uint32_t staging_chunk_count = 4;
+        static constexpr uint32_t upload_cb_count = 8;
+
+        vk::Buffer staging_buffer;
+        VmaAllocation staging_vmaa;
+        std::byte* staging_data = nullptr;
+        uint32_t staging_chunk = 0;
+        vk::DeviceSize staging_offset = 0;
+        // timeline value of the last submission reading from every chunk
+        std::vector<uint64_t> staging_chunk_values;
+        std::vector<vk::CommandBuffer> upload_cbs;
+        std::vector<uint64_t> upload_cb_values;
+        uint32_t upload_cb_idx = 0;
+        bool upload_recording = false;
+        uint64_t upload_value = 0;
+        vk::CommandBuffer graphics_batch_cb;
+        bool graphics_batch_recording = false;
+        std::vector<std::pair<vk::Image, VmaAllocation>> graphics_batch_images;
+
+        void submit(const vk::CommandBuffer& cb, const vk::Queue& queue, bool wait_idle);
+        void wait_for_upload_value(uint64_t value) const;
     };
 } // namespace ve
@@ -29,6 +29,8 @@ namespace ve
 
         void create_vma_allocator();
         void setup_debug_messenger();
+        void create_pipeline_cache();
+        void save_pipeline_cache();
 
     public:
         std::optional<Window> window;
@@ -39,5 +41,7 @@ namespace ve
         QueueFamilyIndices queue_family_indices;
         LogicalDevice logical_device;
         VmaAllocator va;
+        // shared by all pipelines and stored on disk to skip driver compilation of unchanged pipelines
+        vk::PipelineCache pipeline_cache;
     };
 } // namespace ve
@@ -9,6 +9,8 @@
 namespace ve
 {
     constexpr uint32_t frames_in_flight = 2;
+    // output images of the path tracer, one is shown while the compute queue resolves into another and the third holds the newest finished result
+    constexpr uint32_t display_image_count = 3;
 
     struct Vertex {
         glm::vec3 pos;
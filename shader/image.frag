@@ -1,12 +1,54 @@
 #version 460
 
+// luminance difference at which a texel of the traced image only contributes with 1/e of its bilinear weight
+#define SIGMA_LUMINANCE 0.1
+
 layout(location = 0) in vec2 frag_tex;
 
 layout(location = 0) out vec4 out_color;
 
 layout(binding = 0) uniform sampler2D image;
 
+layout(push_constant) uniform PushConstant {
+    // region in the top left of the image that was traced
+    uint traced_width;
+    uint traced_height;
+} pc;
+
+float luminance(in vec3 rgb)
+{
+    return dot(rgb, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// bilinear upscaling whose weights fall off with the luminance difference to the nearest texel
+// smooth regions are interpolated, while edges stay as sharp as with nearest neighbor filtering instead of being blurred across
+vec4 upscale(in ivec2 traced_size)
+{
+    vec2 p = frag_tex * vec2(traced_size) - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+    vec4 nearest = texelFetch(image, clamp(ivec2(round(p)), ivec2(0), traced_size - 1), 0);
+    float nearest_luminance = luminance(nearest.rgb);
+    vec4 sum = vec4(0.0);
+    float sum_weight = 0.0;
+    for (int y = 0; y <= 1; ++y)
+    {
+        for (int x = 0; x <= 1; ++x)
+        {
+            vec4 texel = texelFetch(image, clamp(base + ivec2(x, y), ivec2(0), traced_size - 1), 0);
+            float w = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            w *= exp(-abs(luminance(texel.rgb) - nearest_luminance) / SIGMA_LUMINANCE);
+            sum += texel * w;
+            sum_weight += w;
+        }
+    }
+    // the nearest texel always has a weight above zero
+    return sum / sum_weight;
+}
+
 void main()
 {
-    out_color = texture(image, frag_tex);
+    ivec2 traced_size = ivec2(pc.traced_width, pc.traced_height);
+    if (traced_size == textureSize(image, 0)) out_color = texture(image, frag_tex);
+    else out_color = upscale(traced_size);
 }
@@ -0,0 +1,29 @@
+// the accumulated color of every pixel is updated in place, either as four floats or as four halfs
+// the including shader has to declare the accumulation_data buffer
+
+// largest finite half, brighter samples would turn into infinity
+#define MAX_HALF 65504.0
+
+vec4 load_accumulated_color(in uint lin_idx, in bool half_precision)
+{
+    if (half_precision) return vec4(unpackHalf2x16(accumulation_data[lin_idx * 2]), unpackHalf2x16(accumulation_data[lin_idx * 2 + 1]));
+    uint idx = lin_idx * 4;
+    return uintBitsToFloat(uvec4(accumulation_data[idx], accumulation_data[idx + 1], accumulation_data[idx + 2], accumulation_data[idx + 3]));
+}
+
+void store_accumulated_color(in uint lin_idx, in vec4 color, in bool half_precision)
+{
+    if (half_precision)
+    {
+        color = clamp(color, vec4(-MAX_HALF), vec4(MAX_HALF));
+        accumulation_data[lin_idx * 2] = packHalf2x16(color.xy);
+        accumulation_data[lin_idx * 2 + 1] = packHalf2x16(color.zw);
+        return;
+    }
+    uint idx = lin_idx * 4;
+    uvec4 bits = floatBitsToUint(color);
+    accumulation_data[idx] = bits.x;
+    accumulation_data[idx + 1] = bits.y;
+    accumulation_data[idx + 2] = bits.z;
+    accumulation_data[idx + 3] = bits.w;
+}
@@ -0,0 +1,57 @@
+// adaptive sampling, pixels track the variance of their samples and tiles stop receiving samples once all of their pixels converged
+// needs the push constants and sample_index.glsl
+
+// matches the workgroup size of the kernels that trace camera paths, so converged workgroups exit as a whole
+#define ADAPTIVE_TILE_SIZE 32
+
+layout(binding = 29) buffer PixelStatsBuffer { PixelStats pixel_stats[]; };
+layout(binding = 30) buffer TileMaskBuffer { uint tile_converged[]; };
+// number of tiles that are not converged, read back and reset by the host
+layout(binding = 31) buffer ActiveTileCountBuffer { uint active_tile_count; };
+
+uint get_tile_idx(in ivec2 pixel, in ivec2 viewport_size)
+{
+    uint tile_count_x = (viewport_size.x + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    return (pixel.y / ADAPTIVE_TILE_SIZE) * tile_count_x + pixel.x / ADAPTIVE_TILE_SIZE;
+}
+
+bool is_tile_converged(in ivec2 pixel, in ivec2 viewport_size)
+{
+    return pc.adaptive_target_error > 0.0 && get_first_sample_index() > 0 && tile_converged[get_tile_idx(pixel, viewport_size)] != 0;
+}
+
+// relative standard error of the mean, dark pixels are compared against a small absolute error instead
+bool is_pixel_converged(in PixelStats stats)
+{
+    if (stats.sample_count < float(pc.adaptive_min_samples) || stats.sample_count < 2.0) return false;
+    float variance_of_mean = stats.m2 / (stats.sample_count * (stats.sample_count - 1.0));
+    return sqrt(variance_of_mean) <= pc.adaptive_target_error * max(stats.mean, 1e-3);
+}
+
+// welford update with the luminance of a new sample
+void add_sample_stats(inout PixelStats stats, in float luminance)
+{
+    stats.sample_count += 1.0;
+    float delta = luminance - stats.mean;
+    stats.mean += delta / stats.sample_count;
+    stats.m2 += delta * (luminance - stats.mean);
+}
+
+// statistics of the union of two disjoint sets of samples (Chan et al. 1979)
+PixelStats merge_pixel_stats(in PixelStats a, in PixelStats b)
+{
+    PixelStats stats = PixelStats(a.sample_count + b.sample_count, 0.0, 0.0, 0.0);
+    if (stats.sample_count == 0.0) return stats;
+    float delta = b.mean - a.mean;
+    stats.mean = a.mean + delta * b.sample_count / stats.sample_count;
+    stats.m2 = a.m2 + b.m2 + delta * delta * a.sample_count * b.sample_count / stats.sample_count;
+    return stats;
+}
+
+// adds the statistics of the new samples of a pixel, returns the sample count of the pixel including them
+float update_pixel_stats(in uint lin_idx, in PixelStats new_stats, in bool accumulate)
+{
+    PixelStats stats = accumulate ? merge_pixel_stats(pixel_stats[lin_idx], new_stats) : new_stats;
+    pixel_stats[lin_idx] = stats;
+    return stats.sample_count;
+}
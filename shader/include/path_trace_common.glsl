@@ -0,0 +1,610 @@
+// bindings and functions shared by the megakernel and the wavefront kernels of the path tracer
+// the including shader has to define connect_light()
+
+#extension GL_EXT_ray_tracing : enable
+#extension GL_EXT_ray_query : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+#include "structs.glsl"
+
+#define PI 3.1415926535897932384626433832
+#define INV_PI 0.3183098861837906715377675267
+#define EPS 0.1e-10
+
+layout(push_constant) uniform PushConstant { PathTracerPushConstants pc; };
+
+layout(binding = 0) uniform UniformBuffer { CameraData camera_data; };
+layout(binding = 1) uniform accelerationStructureEXT topLevelAS;
+// accumulated colors of all pixels, read and written in place
+layout(binding = 4) buffer AccumulationBuffer { uint accumulation_data[]; };
+// only bound once the path depth view was used, it is neither read nor written otherwise
+layout(binding = 6) buffer PathDepthBuffer { float path_depth_data[]; };
+layout(binding = 10) readonly buffer VertexPositionBuffer { float vertex_positions[]; };
+layout(binding = 11) readonly buffer IndexBuffer { uint indices[]; };
+layout(binding = 12) readonly buffer MaterialBuffer { Material materials[]; };
+layout(binding = 13) readonly buffer MeshRenderDataBuffer { MeshRenderData mesh_render_data[]; };
+layout(binding = 14) readonly buffer ModelMRDIndicesBuffer { uint model_mrd_indices[]; };
+// emissive triangles with the alias table to pick them proportional to their power
+layout(binding = 15) readonly buffer EmissiveTriangleBuffer { EmissiveTriangle emissive_triangles[]; };
+// bindless, only the textures of the current scene are bound
+layout(binding = 16) uniform sampler2D tex_sampler[];
+// punctual lights, a point light is stored as spot light with cone angles of pi
+layout(binding = 17) readonly buffer LightBuffer { Light lights[]; };
+layout(binding = 18) readonly buffer ModelTransformBuffer { ModelTransform model_transforms[]; };
+// octahedral encoded normal (snorm16x2) and texture coordinates (half2)
+layout(binding = 19) readonly buffer VertexAttributeBuffer { uvec2 vertex_attributes[]; };
+// unorm16x4 colors, only stored for meshes with vertex colors
+layout(binding = 20) readonly buffer VertexColorBuffer { uvec2 vertex_colors[]; };
+layout(binding = 26) readonly buffer LightTreeBuffer { LightTreeNode light_tree[]; };
+layout(binding = 32) buffer AOVBuffer { AOVData aovs[]; };
+
+#include "accumulation.glsl"
+#include "sample_index.glsl"
+#include "random.glsl"
+#include "sampler.glsl"
+#include "adaptive.glsl"
+#include "spectral.glsl"
+
+bool evaluate_shadow_ray(in vec3 ro, in vec3 rd, in vec3 target)
+{
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(rayQuery, topLevelAS, gl_RayFlagsNoneEXT, 0xFF, ro, 0.001, rd, distance(ro, target) - 0.001);
+    rayQueryProceedEXT(rayQuery);
+    if (rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT) return false;
+    return true;
+}
+
+bool evaluate_ray(in vec3 ro, in vec3 rd, out float t, out int instance_id, out int geometry_idx, out int primitive_idx, out vec2 bary)
+{
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(rayQuery, topLevelAS, gl_RayFlagsNoneEXT, 0xFF, ro, 0.001, rd, 10000.0);
+    rayQueryProceedEXT(rayQuery);
+    if (rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT)
+    {
+        t = rayQueryGetIntersectionTEXT(rayQuery, true);
+        instance_id = rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, true);
+        geometry_idx = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, true);
+        primitive_idx = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+        bary = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
+        return true;
+    }
+    return false;
+}
+
+vec2 concentric_sample_disk() {
+    vec2 u = get_sample_2d();
+    vec2 u_offset = 2.0f * u - vec2(1, 1);
+    if (u_offset.x == 0 && u_offset.y == 0)
+        return vec2(0, 0);
+    float theta, r;
+    if (abs(u_offset.x) > abs(u_offset.y))
+    {
+        r = u_offset.x;
+        theta = PI / 4 * (u_offset.y / u_offset.x);
+    }
+    else
+    {
+        r = u_offset.y;
+        theta = PI / 2 - PI / 4 * (u_offset.x / u_offset.y);
+    }
+    return r * vec2(cos(theta), sin(theta));
+}
+
+vec3 cosine_sample_hemisphere(in vec3 n) {
+    vec2 d = concentric_sample_disk();
+    float z = sqrt(max(0, 1 - d.x * d.x - d.y * d.y));
+    vec3 v2, v3;
+    if (abs(n.x) > abs(n.y))
+    {
+        v2 = vec3(-n.z, 0, n.x) / sqrt(n.x * n.x + n.z * n.z);
+    }
+    else
+    {
+        v2 = vec3(0, n.z, -n.y) / sqrt(n.y * n.y + n.z * n.z);
+    }
+    v3 = cross(n, v2);
+    vec3 w = z * n - d.x * v3 - d.y * v2;;
+    return w;
+}
+
+vec3 importance_sample_ggx(in vec3 n, in float roughness)
+{
+    if (roughness == 0.0) return n;
+    float r2 = roughness * roughness;
+    vec2 xi = get_sample_2d();
+    float phi = 2.0 * PI * xi.x;
+    float cos_theta = sqrt((1.0 - xi.y) / (1.0 + (r2 - 1.0) * xi.y));
+    float sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+
+    // spherical coordinates to cartesian coordinates
+    vec3 h;
+    h.x = cos(phi) * sin_theta;
+    h.y = sin(phi) * sin_theta;
+    h.z = cos_theta;
+
+    // tangent-space vector to world-space sample vector
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, n));
+    vec3 bitangent = cross(n, tangent);
+
+    return normalize(h.z * n - tangent * h.x + bitangent * h.y);
+}
+
+float get_refractive_index(float wavelength, vec3 B, vec3 C)
+{
+    // use Sellmeier equation
+    float w2 = wavelength * wavelength;
+    return 1 + sqrt((B.x * w2) / (w2 - C.x) + (B.y * w2) / (w2 - C.y) + (B.z * w2) / (w2 - C.z));
+}
+
+float get_air_refractive_index(float wavelength)
+{
+    // Ciddor (1996)
+    float inv_w2 = 1 / (wavelength * wavelength);
+    return 1 + (0.05792105 / (238.0185 - inv_w2) + 0.00167917 / (57.362 - inv_w2));
+}
+
+float brdf_oren_nayar(in vec3 l, in vec3 n, in vec3 v, float r)
+{
+    float r2 = r * r;
+    float a = 1.0 - (r2 / (2.0 * r2 + 0.33));
+    float b = ((0.45 * r2) / (r2 + 0.09));
+    float nl = dot(l, n);
+    float nv = dot(v, n);
+    float ga = dot(normalize(v - n * nv), normalize(l - n * nl));
+    float theta_i = acos(nv);
+    float theta_o = acos(nl);
+    return INV_PI * (a + b * max(ga, 0.0) * sin(max(theta_i, theta_o)) * tan(min(theta_i, theta_o)));
+}
+
+float ndf_ggx(in float nh, in float r)
+{
+    float r2 = r * r;
+    float denom = (nh * nh * (r2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+    return denom > EPS ? r2 / denom : 1.0;
+}
+
+float geometry_schlick_ggx(in float nl, in float nv, in float r)
+{
+    float r2 = r * r;
+    float gv = nv / (nv * (1 - r2) + r2);
+    float gl = nl / (nl * (1 - r2) + r2);
+    return max(gv * gl, EPS);
+}
+
+float fresnel_schlick(in float vh, in float n_1, in float n_2)
+{
+    float F0 = pow((n_1 - n_2) / (n_1 + n_2), 2);
+    return F0 + (1.0 - F0) * pow(1.0 - vh, 5.0);
+}
+
+vec3 fresnel_schlick(in float vh, in vec3 F0)
+{
+    return F0 + (1.0 - F0) * pow(1.0 - vh, 5.0);
+}
+
+vec4 brdf_cook_torrance(in vec3 h, in vec3 l, in vec3 n, in vec3 v, in vec3 albedo, in float metallic, in float r, in bool h_importance_sampled)
+{
+    float nh = clamp(dot(n, h), 0.0, 1.0);
+    float nv = clamp(dot(n, v), 0.0, 1.0);
+    float nl = clamp(dot(n, l), 0.0, 1.0);
+    float vh = clamp(dot(v, h), 0.0, 1.0);
+
+    float D = ndf_ggx(nh, r);
+    float G = geometry_schlick_ggx(nl, nv, r);
+    vec3 F = fresnel_schlick(vh, albedo);
+    // Microfacet specular = D * G * F / (4 * nl * nv)
+    // pdf = D * nh / (4 * vh)
+    // solid angle cosine = nl, only included for importance sampled directions, the light samples of NEE already carry it
+    vec3 result;
+    if (h_importance_sampled)
+    {
+        // divide by pdf
+        result = (nl > 0 ? ((F * G * vh) / max((nh * nv), EPS)) : vec3(0.0));
+    }
+    else
+    {
+        result = (nl > 0 ? ((D * G * F) / max((4 * nl * nv), EPS)) : vec3(0.0));
+    }
+    return vec4(result, 1.0);
+}
+
+vec3 get_vertex_pos(in uint idx)
+{
+    return vec3(vertex_positions[3 * idx], vertex_positions[3 * idx + 1], vertex_positions[3 * idx + 2]);
+}
+
+vec3 decode_octahedral(in vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+Vertex get_vertex(in MeshRenderData mrd, in uint idx)
+{
+    Vertex v;
+    v.pos = get_vertex_pos(idx);
+    uvec2 attributes = vertex_attributes[idx];
+    v.normal = decode_octahedral(unpackSnorm2x16(attributes.x));
+    v.tex = unpackHalf2x16(attributes.y);
+    if (mrd.color_offset < 0) v.color = vec4(1.0);
+    else
+    {
+        uvec2 color = vertex_colors[mrd.color_offset + idx - mrd.vertex_offset];
+        v.color = vec4(unpackUnorm2x16(color.x), unpackUnorm2x16(color.y));
+    }
+    return v;
+}
+
+Vertex interpolate_attributes(in MeshRenderData mrd, in int primitive_idx, in vec2 bary)
+{
+    Vertex v0 = get_vertex(mrd, indices[mrd.indices_idx + primitive_idx * 3]);
+    Vertex v1 = get_vertex(mrd, indices[mrd.indices_idx + primitive_idx * 3 + 1]);
+    Vertex v2 = get_vertex(mrd, indices[mrd.indices_idx + primitive_idx * 3 + 2]);
+    Vertex v;
+    v.pos = (1.0 - bary.x - bary.y) * v0.pos + bary.x * v1.pos + bary.y * v2.pos;
+    v.normal = normalize((1.0 - bary.x - bary.y) * v0.normal + bary.x * v1.normal + bary.y * v2.normal);
+    v.color = (1.0 - bary.x - bary.y) * v0.color + bary.x * v1.color + bary.y * v2.color;
+    v.tex = (1.0 - bary.x - bary.y) * v0.tex + bary.x * v1.tex + bary.y * v2.tex;
+    // transform from object space of the shared mesh into world space of the referencing model
+    v.pos = (model_transforms[mrd.model_idx].object_to_world * vec4(v.pos, 1.0)).xyz;
+    v.normal = normalize((model_transforms[mrd.model_idx].normal_to_world * vec4(v.normal, 0.0)).xyz);
+    return v;
+}
+
+// power heuristic, delta distributions are marked by a pdf of 0 as only one technique can sample them
+float mis_weight(in float pdf, in float other_pdf)
+{
+    if (pdf <= 0.0 || other_pdf <= 0.0) return 1.0;
+    return (pdf * pdf) / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// scenes with both kinds of lights pick one of them with equal probability
+float get_emissive_triangle_selection_probability()
+{
+    return pc.punctual_light_count > 0 ? 0.5 : 1.0;
+}
+
+// pdf in solid angle measure of picking the given point on the emissive triangle, without the probability of choosing emissive triangles over punctual lights
+float emissive_triangle_pdf(in EmissiveTriangle light, in vec3 dir, in float dist)
+{
+    // the model may be animated, so normal and area are transformed into world space, the area scales with det(M) * |M^-T n|
+    ModelTransform light_transform = model_transforms[mesh_render_data[light.mrd_idx].model_idx];
+    vec3 light_normal = mat3(light_transform.normal_to_world) * light.normal;
+    float light_area = light.area * abs(determinant(mat3(light_transform.object_to_world))) * length(light_normal);
+    // emission is two-sided
+    float cos_light = abs(dot(dir, normalize(light_normal)));
+    if (light_area <= 0.0 || cos_light <= 0.0) return 0.0;
+    // from area measure to solid angle
+    return light.probability / light_area * dist * dist / cos_light;
+}
+
+// pick a point on an emissive triangle for NEE
+bool sample_emissive_triangle(in uint mrd_idx, in Vertex vertex, inout vec3 dir, inout vec3 light_pos, inout vec4 radiance, inout float light_pdf)
+{
+    // pick triangle proportional to its power with the alias table
+    uint light_idx = min(uint(get_sample() * pc.emissive_triangle_count), pc.emissive_triangle_count - 1);
+    if (get_sample() >= emissive_triangles[light_idx].alias_threshold) light_idx = emissive_triangles[light_idx].alias;
+    EmissiveTriangle light = emissive_triangles[light_idx];
+    // perform NEE except current surface is a light and NEE picked this light
+    if (light.mrd_idx == mrd_idx) return false;
+    MeshRenderData light_mrd = mesh_render_data[light.mrd_idx];
+    vec2 bary = get_sample_2d();
+    if (bary.x + bary.y > 1.0) bary = 1.0 - bary;
+    // only the position is fetched, normal and area are precomputed
+    uint first_idx = light_mrd.indices_idx + light.primitive_idx * 3;
+    vec3 p = (1.0 - bary.x - bary.y) * get_vertex_pos(indices[first_idx]) + bary.x * get_vertex_pos(indices[first_idx + 1]) + bary.y * get_vertex_pos(indices[first_idx + 2]);
+    light_pos = (model_transforms[light_mrd.model_idx].object_to_world * vec4(p, 1.0)).xyz;
+    float dist = distance(light_pos, vertex.pos);
+    if (dist <= EPS) return false;
+    dir = (light_pos - vertex.pos) / dist;
+    light_pdf = emissive_triangle_pdf(light, dir, dist);
+    if (light_pdf <= 0.0) return false;
+    radiance = materials[light_mrd.mat_idx].emission * materials[light_mrd.mat_idx].emission_strength * (max(dot(dir, vertex.normal), 0.0) / light_pdf);
+    return true;
+}
+
+// conservative estimate of the contribution of all lights in the node to the given point
+float light_tree_importance(in LightTreeNode node, in vec3 p, in vec3 n)
+{
+    vec3 center = 0.5 * (node.bounds_min + node.bounds_max);
+    float radius = 0.5 * length(node.bounds_max - node.bounds_min);
+    vec3 to_p = p - center;
+    float d2 = dot(to_p, to_p);
+    // inside of the bounds light can arrive from any direction
+    if (d2 <= radius * radius) return node.power / max(radius * radius, EPS);
+    float d = sqrt(d2);
+    vec3 w = to_p / d;
+    // angle under which the bounds are seen from p
+    float theta_u = asin(radius / d);
+    float theta = acos(clamp(dot(node.axis, w), -1.0, 1.0));
+    float theta_prime = max(theta - node.theta_o - theta_u, 0.0);
+    if (theta_prime >= node.theta_e) return 0.0;
+    float theta_i = acos(clamp(dot(n, -w), -1.0, 1.0));
+    float theta_i_prime = max(theta_i - theta_u, 0.0);
+    return node.power * cos(theta_prime) * max(cos(theta_i_prime), 0.0) / d2;
+}
+
+// traverse the light tree choosing children proportional to their importance
+bool sample_punctual_light(in Vertex vertex, inout vec3 dir, inout vec3 light_pos, inout vec4 radiance, inout float light_pdf)
+{
+    uint node_idx = 0;
+    float prob = 1.0;
+    while (light_tree[node_idx].leaf == 0)
+    {
+        uint left = light_tree[node_idx].child_or_light;
+        float importance_left = light_tree_importance(light_tree[left], vertex.pos, vertex.normal);
+        float importance_right = light_tree_importance(light_tree[left + 1], vertex.pos, vertex.normal);
+        if (importance_left + importance_right <= 0.0) return false;
+        float prob_left = importance_left / (importance_left + importance_right);
+        if (get_sample() < prob_left)
+        {
+            node_idx = left;
+            prob *= prob_left;
+        }
+        else
+        {
+            node_idx = left + 1;
+            prob *= 1.0 - prob_left;
+        }
+    }
+    Light light = lights[light_tree[node_idx].child_or_light];
+    light_pos = light.pos_inner.xyz;
+    vec3 to_light = light_pos - vertex.pos;
+    float d2 = max(dot(to_light, to_light), EPS);
+    dir = to_light / sqrt(d2);
+    // smooth spot cone falloff between outer and inner cone, point lights have both cone angles at pi
+    float cos_angle = dot(-dir, light.dir_intensity.xyz);
+    float cos_inner = light.pos_inner.w;
+    float cos_outer = light.color_outer.w;
+    float falloff = cos_inner > cos_outer ? clamp((cos_angle - cos_outer) / (cos_inner - cos_outer), 0.0, 1.0) : float(cos_angle >= cos_outer);
+    falloff *= falloff;
+    if (falloff <= 0.0) return false;
+    radiance = vec4(light.color_outer.rgb * light.dir_intensity.w * falloff * max(dot(dir, vertex.normal), 0.0) / (d2 * prob), 1.0);
+    // punctual lights can not be hit by BSDF sampling
+    light_pdf = 0.0;
+    return true;
+}
+
+// pick a point on a light for NEE, the shadow ray towards it still needs to be traced
+// radiance already includes the cosine at the surface and is divided by the pdf, light_pdf is 0 for delta lights
+bool sample_light(in uint mrd_idx, in Vertex vertex, out vec3 dir, out vec3 light_pos, out vec4 radiance, out float light_pdf)
+{
+    dir = vec3(0.0);
+    light_pos = vertex.pos;
+    radiance = vec4(0.0, 0.0, 0.0, 1.0);
+    light_pdf = 0.0;
+    bool has_triangles = pc.emissive_triangle_count > 0;
+    bool has_punctual = pc.punctual_light_count > 0;
+    if (!has_triangles && !has_punctual) return false;
+    float selection_prob = get_emissive_triangle_selection_probability();
+    if (has_triangles && (!has_punctual || get_sample() < selection_prob))
+    {
+        if (!sample_emissive_triangle(mrd_idx, vertex, dir, light_pos, radiance, light_pdf)) return false;
+    }
+    else
+    {
+        if (!sample_punctual_light(vertex, dir, light_pos, radiance, light_pdf)) return false;
+        selection_prob = 1.0 - selection_prob;
+    }
+    radiance.rgb /= selection_prob;
+    light_pdf *= selection_prob;
+    return true;
+}
+
+// adds the contribution of a light sample if the light is visible from pos
+// the megakernel traces the shadow ray right away, the wavefront kernels defer it to a separate pass
+void connect_light(in vec3 pos, in vec3 dir, in vec3 light_pos, in vec4 contribution, inout vec4 emission);
+
+// pdf in solid angle measure of NEE picking the point that was hit by BSDF sampling from the previous interaction
+float hit_light_pdf(in uint mrd_idx, in int primitive_idx, in vec3 dir, in float t, in uint last_mrd_idx)
+{
+    MeshRenderData mrd = mesh_render_data[mrd_idx];
+    // NEE never picks lights on the surface it starts from
+    if (mrd.emissive_triangle_offset < 0 || mrd_idx == last_mrd_idx || pc.emissive_triangle_count == 0) return 0.0;
+    EmissiveTriangle light = emissive_triangles[mrd.emissive_triangle_offset + primitive_idx];
+    return emissive_triangle_pdf(light, dir, t) * get_emissive_triangle_selection_probability();
+}
+
+// get color of material at position
+vec4 get_material_color(in Material m, in Vertex vertex)
+{
+    if (m.base_texture >= 0) return texture(tex_sampler[nonuniformEXT(m.base_texture)], vertex.tex);
+    else if (length(m.base_color) > 0.0) return m.base_color;
+    return vec4(0.0, 0.0, 0.0, 0.0);
+}
+
+// last_bsdf_pdf is the solid angle pdf of the direction sampled at the previous interaction, 0 if it was a delta distribution or the path just started
+// once the path is dispersed, the emission gathered so far is moved to shared_emission and emission only belongs to the hero wavelength
+void apply_surface_parameters(in uint mrd_idx, in int primitive_idx, in Vertex vertex, in vec3 v, in uint wavelength, in float t, inout float last_bsdf_pdf, inout uint last_mrd_idx, inout bool dispersed, inout vec4 shared_emission, inout vec4 emission, inout vec4 attenuation, out vec3 l)
+{
+    MeshRenderData mrd = mesh_render_data[mrd_idx];
+    vec3 light_pos;
+    vec4 light_radiance;
+    float light_pdf;
+    // object does not have material, make it fully diffuse with the vertex color
+    if (mrd.mat_idx < 0)
+    {
+        if (sample_light(mrd_idx, vertex, l, light_pos, light_radiance, light_pdf))
+        {
+            float bsdf_pdf = max(dot(l, vertex.normal), 0.0) * INV_PI;
+            connect_light(vertex.pos, l, light_pos, attenuation * brdf_oren_nayar(l, vertex.normal, v, 1.0) * vertex.color * light_radiance * mis_weight(light_pdf, bsdf_pdf), emission);
+        }
+        l = cosine_sample_hemisphere(vertex.normal);
+        // cosine and pdf of cosine sampling cancel out except for pi
+        attenuation *= brdf_oren_nayar(l, vertex.normal, v, 1.0) * PI * vertex.color;
+        last_bsdf_pdf = max(dot(l, vertex.normal), 0.0) * INV_PI;
+        last_mrd_idx = mrd_idx;
+        return;
+    }
+    Material m = materials[mrd.mat_idx];
+    vec4 color = get_material_color(m, vertex);
+    if (get_sample() < m.B_transmission.w)
+    {
+        // transmission
+        // without Sellmeier coefficients the refraction does not depend on the wavelength and all wavelengths continue
+        bool dispersive = any(notEqual(m.B_transmission.xyz, vec3(0.0)));
+        // otherwise the secondary wavelengths are terminated and only the hero wavelength continues
+        if (dispersive && !dispersed)
+        {
+            shared_emission = emission;
+            emission = vec4(0.0);
+            dispersed = true;
+        }
+        // convert wavelength to micrometer as Sellmeier assumes micrometers
+        // the air of non dispersive materials is evaluated at a fixed wavelength, so the direction is shared by all wavelengths
+        float w = dispersive ? float(wavelength) / 1000.0 : 0.55;
+        float ref_idx_air = get_air_refractive_index(w);
+        float ref_idx_mat = get_refractive_index(w, m.B_transmission.xyz, m.C);
+        // view vector and normal align -> from air to transmissive material
+        float ref_idx_one = ref_idx_air;
+        float ref_idx_two = ref_idx_mat;
+        if (dot(v, vertex.normal) < 0.0)
+        {
+            // view vector and normal do not align -> from transmissive material to air
+            vertex.normal = -vertex.normal;
+            ref_idx_one = ref_idx_mat;
+            ref_idx_two = ref_idx_air;
+            // simplified Beer-Lambert for attenuation; use opacity as molar attenuation coefficient
+            attenuation *= vec4(color.rgb * exp(-t * (1.0 - color.a)), 1.0);
+        }
+        float F = fresnel_schlick(dot(v, vertex.normal), ref_idx_one, ref_idx_two);
+        l = refract(-v, vertex.normal, ref_idx_one / ref_idx_two);
+        if (length(l) < 0.1 || get_sample() < F) l = reflect(-v, vertex.normal);
+        last_bsdf_pdf = 0.0;
+        last_mrd_idx = mrd_idx;
+        return;
+    }
+    else
+    {
+        // emission that was hit by BSDF sampling, weighted against NEE from the previous interaction
+        float light_weight = mis_weight(last_bsdf_pdf, hit_light_pdf(mrd_idx, primitive_idx, -v, t, last_mrd_idx));
+        emission += attenuation * m.emission * m.emission_strength * light_weight;
+        // surface reflection
+        if (get_sample() < m.metallic)
+        {
+            // a perfect mirror is a delta distribution that NEE can not sample
+            if (m.roughness > 0.0 && sample_light(mrd_idx, vertex, l, light_pos, light_radiance, light_pdf))
+            {
+                vec3 h = normalize(v + l);
+                float bsdf_pdf = ndf_ggx(clamp(dot(vertex.normal, h), 0.0, 1.0), m.roughness) * clamp(dot(vertex.normal, h), 0.0, 1.0) / max(4.0 * clamp(dot(v, h), 0.0, 1.0), EPS);
+                connect_light(vertex.pos, l, light_pos, attenuation * brdf_cook_torrance(h, l, vertex.normal, v, color.rgb, m.metallic, m.roughness, false) * light_radiance * mis_weight(light_pdf, bsdf_pdf), emission);
+            }
+            vec3 h = importance_sample_ggx(vertex.normal, m.roughness);
+            l = reflect(-v, h);
+            attenuation *= brdf_cook_torrance(h, l, vertex.normal, v, color.rgb, m.metallic, m.roughness, true);
+            float nh = clamp(dot(vertex.normal, h), 0.0, 1.0);
+            last_bsdf_pdf = m.roughness > 0.0 ? ndf_ggx(nh, m.roughness) * nh / max(4.0 * clamp(dot(v, h), 0.0, 1.0), EPS) : 0.0;
+        }
+        else
+        {
+            if (sample_light(mrd_idx, vertex, l, light_pos, light_radiance, light_pdf))
+            {
+                float bsdf_pdf = max(dot(l, vertex.normal), 0.0) * INV_PI;
+                connect_light(vertex.pos, l, light_pos, attenuation * brdf_oren_nayar(l, vertex.normal, v, m.roughness) * color * light_radiance * mis_weight(light_pdf, bsdf_pdf), emission);
+            }
+            l = cosine_sample_hemisphere(vertex.normal);
+            // cosine and pdf of cosine sampling cancel out except for pi
+            attenuation *= brdf_oren_nayar(l, vertex.normal, v, m.roughness) * PI * color;
+            last_bsdf_pdf = max(dot(l, vertex.normal), 0.0) * INV_PI;
+        }
+        last_mrd_idx = mrd_idx;
+        return;
+    }
+}
+
+#define MAX_PATH_LENGTH 128
+
+ivec2 get_frame_pixel(in ivec2 pixel)
+{
+    return pixel + ivec2(pc.frame_offset_x, pc.frame_offset_y);
+}
+
+ivec2 get_frame_size()
+{
+    return ivec2(pc.frame_width, pc.frame_height);
+}
+
+// start a camera ray through a jittered position on the given pixel of the frame
+// sensor_weight is the inverse probability of the sampled position, given by the geometry term and surface of sensor, cosine of outgoing direction and at sensor are the same
+void generate_camera_ray(in ivec2 pixel, in ivec2 viewport_size, out vec3 origin, out vec3 dir, out float sensor_weight)
+{
+    vec2 jitter = get_sample_2d() - 0.5;
+    vec2 norm_pixel = ((vec2(pixel) + jitter) / vec2(viewport_size) - 0.5) * camera_data.sensor_size;
+    origin = camera_data.pos;
+    vec3 pixel_pos = -camera_data.w * camera_data.focal_length + norm_pixel.x * camera_data.u + norm_pixel.y * camera_data.v + origin;
+    dir = normalize(pixel_pos - origin);
+    sensor_weight = (pow(dot(dir, -camera_data.w), 2) * (camera_data.sensor_size.x * camera_data.sensor_size.y)) / pow(length(pixel_pos - origin), 2);
+}
+
+// attenuated accumulated emission multiplied with spectral rgb response divided by probability of spectral and pixel sample
+// emission before the first dispersive interaction is seen by all hero wavelengths, emission after it only by the hero wavelength
+vec4 get_sample_color(in vec4 shared_emission, in vec4 emission, in bool dispersed, in uint hero_wavelength, in float sensor_weight)
+{
+    vec4 color = dispersed ? shared_emission * hero_wavelengths_to_rgba(hero_wavelength) + emission * hero_wavelength_to_rgba(hero_wavelength) : emission * hero_wavelengths_to_rgba(hero_wavelength);
+    return rgb_to_xyz(color * sensor_weight);
+}
+
+// the output image is only written by the tonemap pass when the result is shown or saved
+void store_pixel(in ivec2 pixel, in ivec2 viewport_size, in vec4 color, in float path_depth)
+{
+    uint lin_idx = pixel.y * viewport_size.x + pixel.x;
+    store_accumulated_color(lin_idx, color, pc.half_precision_accumulation != 0);
+    if (pc.path_depth_view) path_depth_data[lin_idx] = path_depth;
+}
+
+// interpolate the mean of the new samples with the previous samples of the pixel and write the result to the accumulation buffer
+// pixels can have a different number of samples with adaptive sampling, so the weights use the sample count of the pixel
+void write_samples(in ivec2 pixel, in ivec2 viewport_size, in vec4 color, in float path_depth, in PixelStats stats, in bool accumulate)
+{
+    uint lin_idx = pixel.y * viewport_size.x + pixel.x;
+    accumulate = accumulate && get_first_sample_index() > 0;
+    float pixel_sample_count = update_pixel_stats(lin_idx, stats, accumulate);
+    if (accumulate)
+    {
+        float weight_new = stats.sample_count / pixel_sample_count;
+        float weight_old = 1.0 - weight_new;
+        color = load_accumulated_color(lin_idx, pc.half_precision_accumulation != 0) * weight_old + color * weight_new;
+        if (pc.path_depth_view) path_depth = path_depth_data[lin_idx] * weight_old + path_depth * weight_new;
+    }
+    store_pixel(pixel, viewport_size, color, path_depth);
+}
+
+void write_sample(in ivec2 pixel, in ivec2 viewport_size, in vec4 color, in float path_depth, in bool accumulate)
+{
+    PixelStats stats = PixelStats(0.0, 0.0, 0.0, 0.0);
+    add_sample_stats(stats, color.y);
+    write_samples(pixel, viewport_size, color, path_depth, stats, accumulate);
+}
+
+// albedo, normal and distance of the first hit of a sample
+// misses are zero for all of them, so they do not blend with geometry in the denoiser
+void get_aovs(in uint mrd_idx, in Vertex vertex, in float t, in bool hit, out vec3 albedo, out vec4 normal)
+{
+    albedo = vec3(0.0);
+    normal = vec4(0.0);
+    if (hit)
+    {
+        int mat_idx = mesh_render_data[mrd_idx].mat_idx;
+        albedo = mat_idx < 0 ? vertex.color.rgb : get_material_color(materials[mat_idx], vertex).rgb;
+        normal = vec4(vertex.normal, t);
+    }
+}
+
+// must be called once per dispatch before write_samples() as the weight depends on the sample count of the pixel
+// albedo and normal are the averages over all samples of the dispatch
+// the distance of the first hit is used to reproject the accumulated samples when the camera moves
+void write_aovs(in uint lin_idx, in vec3 albedo, in vec4 normal)
+{
+    if (get_first_sample_index() > 0)
+    {
+        float weight_new = float(pc.samples_per_pixel) / (pixel_stats[lin_idx].sample_count + float(pc.samples_per_pixel));
+        albedo = mix(aovs[lin_idx].albedo.rgb, albedo, weight_new);
+        normal = mix(aovs[lin_idx].normal, normal, weight_new);
+    }
+    aovs[lin_idx] = AOVData(vec4(albedo, 0.0), normal);
+}
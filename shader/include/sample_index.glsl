@@ -0,0 +1,10 @@
+// number of samples accumulated before a dispatch
+// the host writes the count before each submission so recorded command buffers can be submitted again
+// a submission can hold several dispatches, the later ones add their offset from the push constants
+
+layout(binding = 35) readonly buffer SampleIndexBuffer { uint submission_sample_index; };
+
+uint get_first_sample_index()
+{
+    return submission_sample_index + pc.dispatch_sample_offset;
+}
@@ -0,0 +1,104 @@
+// sample generation of the path tracer, every random decision of a path takes the next dimension of its sample
+// needs random.glsl, the push constants, the sampler bindings and sample_index.glsl
+
+#define SAMPLER_PCG 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+
+// must match sobol_dimensions and blue_noise_size in SampleTables.hpp
+#define SOBOL_DIMENSIONS 4
+#define BLUE_NOISE_SIZE 64
+
+// dimensions reserved for the camera ray and each bounce, decisions beyond them fall back to pcg
+// the dimensions of a bounce are fixed so that the same decisions of different samples use the same dimensions
+#define CAMERA_SAMPLE_DIMENSIONS 4
+#define BOUNCE_SAMPLE_DIMENSIONS 16
+
+// largest float below 1
+#define ONE_MINUS_EPSILON 0.99999994
+
+layout(binding = 27) readonly buffer SobolMatrixBuffer { uint sobol_matrices[]; };
+layout(binding = 28) readonly buffer BlueNoiseBuffer { float blue_noise[]; };
+
+ivec2 sampler_pixel;
+// sample of the current dispatch, the samples of a pixel are numbered from get_first_sample_index() on
+uint sampler_sample_offset = 0;
+uint sampler_dimension;
+uint sampler_dimension_end;
+
+// scramble the bits of x in a way that is equivalent to owen scrambling of the reversed bits (Burley 2020)
+uint laine_karras_permutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nested_uniform_scramble(uint x, uint seed)
+{
+    return bitfieldReverse(laine_karras_permutation(bitfieldReverse(x), seed));
+}
+
+uint sobol(uint index, uint dimension)
+{
+    uint result = 0;
+    for (uint bit = 0; index != 0; index >>= 1, ++bit)
+    {
+        if ((index & 1) != 0) result ^= sobol_matrices[dimension * 32 + bit];
+    }
+    return result;
+}
+
+// owen scrambled sobol sequence, consecutive dimensions are grouped into independently shuffled and scrambled sets of SOBOL_DIMENSIONS
+// seed decorrelates pixels, the blue noise sampler uses the same sequence for all pixels
+float owen_sobol(uint dimension, uint seed)
+{
+    uint set = dimension / SOBOL_DIMENSIONS;
+    uint set_dimension = dimension % SOBOL_DIMENSIONS;
+    uint index = nested_uniform_scramble(get_first_sample_index() + sampler_sample_offset, PCGHash(seed ^ PCGHash(set)));
+    uint x = nested_uniform_scramble(sobol(index, set_dimension), PCGHash(seed ^ PCGHash(dimension + 0x9e3779b9u)));
+    return min(float(x >> 8) / 16777216.0, ONE_MINUS_EPSILON);
+}
+
+// the shared sequence is decorrelated between pixels by a toroidal shift with a blue noise mask, so the remaining error is distributed as blue noise
+// the mask is offset per dimension to not reuse the same shift for all decisions
+float blue_noise_sobol(uint dimension)
+{
+    uint offset = PCGHash(dimension);
+    ivec2 mask_pixel = (sampler_pixel + ivec2(offset & 0xFFFF, offset >> 16)) % BLUE_NOISE_SIZE;
+    return fract(owen_sobol(dimension, 0) + blue_noise[mask_pixel.y * BLUE_NOISE_SIZE + mask_pixel.x]);
+}
+
+// the pcg fallback keeps being seeded from the pixel and sample so it can still be used directly
+void start_pixel_sample(ivec2 pixel, ivec2 viewport_size, uint sample_offset)
+{
+    sampler_pixel = pixel;
+    sampler_sample_offset = sample_offset;
+    sampler_dimension = 0;
+    sampler_dimension_end = CAMERA_SAMPLE_DIMENSIONS;
+    rng_state = (pixel.y * viewport_size.x + pixel.x + (get_first_sample_index() + sample_offset + 3) * viewport_size.x * viewport_size.y);
+}
+
+void start_bounce_sample(uint bounce)
+{
+    sampler_dimension = CAMERA_SAMPLE_DIMENSIONS + bounce * BOUNCE_SAMPLE_DIMENSIONS;
+    sampler_dimension_end = sampler_dimension + BOUNCE_SAMPLE_DIMENSIONS;
+}
+
+float get_sample()
+{
+    if (pc.sampler == SAMPLER_PCG || sampler_dimension >= sampler_dimension_end) return pcg_random_state();
+    uint dimension = sampler_dimension++;
+    if (pc.sampler == SAMPLER_BLUE_NOISE) return blue_noise_sobol(dimension);
+    return owen_sobol(dimension, PCGHash(uint(sampler_pixel.y) * 65536u + uint(sampler_pixel.x)));
+}
+
+vec2 get_sample_2d()
+{
+    // evaluation order of function arguments is not defined
+    float x = get_sample();
+    return vec2(x, get_sample());
+}
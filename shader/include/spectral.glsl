@@ -1,3 +1,26 @@
+// wavelengths are sampled in bins of 5nm from 380nm to 780nm
+#define WAVELENGTH_BIN_COUNT 81
+// every path carries a hero wavelength and secondary wavelengths that are rotated through the spectrum
+#define HERO_WAVELENGTH_COUNT 4
+
+// cumulative distribution of the sum of the color matching functions, used to importance sample the hero wavelength
+const float cie_cdf[WAVELENGTH_BIN_COUNT + 1] = {
+    0.0000000, 0.0001232, 0.0003229, 0.0007034, 0.0013897, 0.0026780,
+    0.0047681, 0.0087001, 0.0157360, 0.0279643, 0.0476355, 0.0738559,
+    0.1045559, 0.1375971, 0.1712949, 0.2047712, 0.2376938, 0.2692002,
+    0.2981034, 0.3226534, 0.3428768, 0.3592164, 0.3723726, 0.3833718,
+    0.3931450, 0.4025018, 0.4122033, 0.4226612, 0.4343435, 0.4476245,
+    0.4625994, 0.4792838, 0.4975388, 0.5172646, 0.5383738, 0.5607886,
+    0.5844621, 0.6093147, 0.6352014, 0.6619693, 0.6894157, 0.7173036,
+    0.7453208, 0.7731525, 0.8004882, 0.8269099, 0.8520682, 0.8755560,
+    0.8970771, 0.9163490, 0.9330770, 0.9472299, 0.9590667, 0.9687822,
+    0.9765652, 0.9826559, 0.9873397, 0.9908632, 0.9934492, 0.9953115,
+    0.9966653, 0.9976604, 0.9983592, 0.9988411, 0.9991765, 0.9994182,
+    0.9995898, 0.9997130, 0.9998004, 0.9998612, 0.9999033, 0.9999329,
+    0.9999548, 0.9999688, 0.9999797, 0.9999860, 0.9999906, 0.9999953,
+    0.9999969, 0.9999984, 1.0000000, 1.0000000
+};
+
 vec3 cie_colour_match[81] = {
     vec3(0.0014f,0.0000f,0.0065f), vec3(0.0022f,0.0001f,0.0105f), vec3(0.0042f,0.0001f,0.0201f),
     vec3(0.0076f,0.0002f,0.0362f), vec3(0.0143f,0.0004f,0.0679f), vec3(0.0232f,0.0006f,0.1102f),
@@ -54,13 +77,56 @@ vec4 wavelength_to_rgba(uint wavelength)
     return xyz_to_rgb(wavelength_to_xyz(wavelength));
 }
 
-uint get_random_wavelength(float random)
+// sample the hero wavelength proportional to the color matching functions
+uint sample_hero_wavelength(float random)
+{
+    // first bin whose cumulative probability reaches the random number
+    uint low = 0;
+    uint high = WAVELENGTH_BIN_COUNT - 1;
+    while (low < high)
+    {
+        uint mid = (low + high) / 2;
+        if (cie_cdf[mid + 1] < random) low = mid + 1;
+        else high = mid;
+    }
+    return 380 + low * 5;
+}
+
+float get_wavelength_probability(uint wavelength)
+{
+    uint bin = (wavelength - 380) / 5;
+    return cie_cdf[bin + 1] - cie_cdf[bin];
+}
+
+// the secondary wavelengths are the hero wavelength rotated by equal steps through the spectrum
+uint get_hero_wavelength(uint hero_wavelength, uint i)
+{
+    uint bin = ((hero_wavelength - 380) / 5 + i * (WAVELENGTH_BIN_COUNT / HERO_WAVELENGTH_COUNT)) % WAVELENGTH_BIN_COUNT;
+    return 380 + bin * 5;
+}
+
+// spectral rgb response of all hero wavelengths, each weighted with the balance heuristic over the rotations that could have generated it
+vec4 hero_wavelengths_to_rgba(uint hero_wavelength)
 {
-    return 380 + uint(pcg_random_state() * 80.999) * 5;
+    vec4 rgba = vec4(0.0);
+    for (uint i = 0; i < HERO_WAVELENGTH_COUNT; ++i)
+    {
+        uint wavelength = get_hero_wavelength(hero_wavelength, i);
+        uint bin = (wavelength - 380) / 5;
+        float pdf_sum = 0.0;
+        for (uint j = 0; j < HERO_WAVELENGTH_COUNT; ++j)
+        {
+            // hero wavelength that would have produced this wavelength as its j-th rotation
+            uint hero_bin = (bin + WAVELENGTH_BIN_COUNT - j * (WAVELENGTH_BIN_COUNT / HERO_WAVELENGTH_COUNT)) % WAVELENGTH_BIN_COUNT;
+            pdf_sum += get_wavelength_probability(380 + hero_bin * 5);
+        }
+        if (pdf_sum > 0.0) rgba += wavelength_to_rgba(wavelength) / pdf_sum;
+    }
+    return rgba;
 }
 
-// uniform samples of wavelength -> every sample has the same probability
-float get_inv_wavelength_probability()
+// spectral rgb response of the hero wavelength alone divided by its probability, used once the other wavelengths are terminated
+vec4 hero_wavelength_to_rgba(uint hero_wavelength)
 {
-    return 80.0;
+    return wavelength_to_rgba(hero_wavelength) / get_wavelength_probability(hero_wavelength);
 }
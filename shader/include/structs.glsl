@@ -1,10 +1,35 @@
 struct PathTracerPushConstants {
-    uint sample_count;
+    // samples that the megakernel traces per pixel in one dispatch, the wavefront kernels always trace one
+    uint samples_per_pixel;
     bool attenuation_view;
     bool emission_view;
     bool normal_view;
     bool tex_view;
     bool path_depth_view;
+    uint emissive_triangle_count;
+    uint punctual_light_count;
+    // only used by the wavefront kernels
+    uint bounce;
+    // pass of kernels that are dispatched several times, only reproject
+    uint kernel_pass;
+    // SAMPLER_PCG, SAMPLER_SOBOL or SAMPLER_BLUE_NOISE
+    uint sampler;
+    // relative standard error at which a tile stops receiving samples, 0 disables adaptive sampling
+    float adaptive_target_error;
+    uint adaptive_min_samples;
+    // traced region in the top left of the images and per pixel buffers, smaller than them while the resolution is reduced
+    uint viewport_width;
+    uint viewport_height;
+    // the camera covers the frame, the viewport is the region of it that starts at the frame offset
+    // they only differ for tiled rendering, so the samples of a pixel do not depend on the tile that contains it
+    int frame_offset_x;
+    int frame_offset_y;
+    uint frame_width;
+    uint frame_height;
+    // the accumulated colors are stored as halfs instead of floats, enough for previews
+    uint half_precision_accumulation;
+    // samples traced by the earlier dispatches of the same submission
+    uint dispatch_sample_offset;
 };
 
 struct CameraData
@@ -18,14 +43,36 @@ struct CameraData
     float exposure;
 };
 
-struct PixelData {
-    vec4 col;
+// running mean and variance of the luminance of the samples of a pixel
+struct PixelStats {
+    float sample_count;
+    float mean;
+    // sum of squared differences from the mean
+    float m2;
+    float padding;
+};
+
+// first hit albedo and normal averaged over the samples of a pixel, they guide the denoiser
+struct AOVData {
+    vec4 albedo;
+    // distance of the first hit in w
+    vec4 normal;
 };
 
 struct MeshRenderData {
     int mat_idx;
     uint indices_idx;
     uint idx_count;
+    uint model_idx;
+    int color_offset;
+    uint vertex_offset;
+    // first entry of the mesh in the emissive triangles, -1 if it does not emit light
+    int emissive_triangle_offset;
+};
+
+struct ModelTransform {
+    mat4 object_to_world;
+    mat4 normal_to_world;
 };
 
 struct Material {
@@ -43,63 +90,38 @@ struct Material {
     //int occlusion_texture;
 };
 
+struct EmissiveTriangle {
+    // geometric normal and area in object space
+    vec3 normal;
+    float area;
+    uint mrd_idx;
+    uint primitive_idx;
+    float probability;
+    float alias_threshold;
+    uint alias;
+};
+
 struct Light {
     vec4 dir_intensity;
     vec4 pos_inner;
     vec4 color_outer;
 };
 
-struct AlignedVertex {
-    vec4 pos_normal_x;
-    vec4 normal_yz_color_rg;
-    vec4 color_ba_tex;
+struct LightTreeNode {
+    vec3 bounds_min;
+    float power;
+    vec3 bounds_max;
+    float theta_o;
+    vec3 axis;
+    float theta_e;
+    // left child of inner nodes, the right child directly follows it, light of leaves
+    uint child_or_light;
+    uint leaf;
 };
 
-vec3 get_vertex_pos(in AlignedVertex v) { return v.pos_normal_x.xyz; }
-void set_vertex_pos(inout AlignedVertex v, in vec3 pos) { v.pos_normal_x.xyz = pos; }
-
-vec3 get_vertex_normal(in AlignedVertex v) { return vec3(v.pos_normal_x.w, v.normal_yz_color_rg.xy); }
-void set_vertex_normal(inout AlignedVertex v, in vec3 normal) {
-    v.pos_normal_x.w = normal.x;
-    v.normal_yz_color_rg.xy = normal.yz;
-}
-
-vec4 get_vertex_color(in AlignedVertex v) { return vec4(v.normal_yz_color_rg.zw, v.color_ba_tex.xy); }
-void set_vertex_color(inout AlignedVertex v, in vec4 color) {
-    v.normal_yz_color_rg.zw = color.xy;
-    v.color_ba_tex.xy = color.zw;
-}
-
-vec2 get_vertex_tex(in AlignedVertex v) { return v.color_ba_tex.zw; }
-void set_vertex_tex(inout AlignedVertex v, in vec2 tex) { v.color_ba_tex.zw = tex; }
-
 struct Vertex {
     vec3 pos;
     vec3 normal;
     vec4 color;
     vec2 tex;
 };
-
-Vertex unpack_vertex(AlignedVertex v)
-{
-    Vertex vert;
-    vert.pos = v.pos_normal_x.xyz;
-    vert.normal.x = v.pos_normal_x.w;
-    vert.normal.yz = v.normal_yz_color_rg.xy;
-    vert.color.rg = v.normal_yz_color_rg.zw;
-    vert.color.ba = v.color_ba_tex.xy;
-    vert.tex = v.color_ba_tex.zw;
-    return vert;
-}
-
-AlignedVertex pack_vertex(Vertex v)
-{
-    AlignedVertex vert;
-    vert.pos_normal_x.xyz = v.pos;
-    vert.pos_normal_x.w = v.normal.x;
-    vert.normal_yz_color_rg.xy = v.normal.yz;
-    vert.normal_yz_color_rg.zw = v.color.rg;
-    vert.color_ba_tex.xy = v.color.ba;
-    vert.color_ba_tex.zw = v.tex;
-    return vert;
-}
@@ -0,0 +1,28 @@
+// operators that map the linear rgb of the accumulated samples to the displayed rgba8 values
+
+#define TONEMAP_CLAMP 0
+#define TONEMAP_REINHARD 1
+#define TONEMAP_ACES 2
+
+#define INV_GAMMA 0.454545454545
+
+float luminance(in vec3 rgb)
+{
+    return dot(rgb, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// ACES filmic curve fitted by Narkowicz 2015
+vec3 aces_film(in vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+// the color is already multiplied with the exposure, alpha is only gamma corrected
+vec4 tonemap(in vec4 rgba, in uint tonemap_operator)
+{
+    vec3 rgb = max(rgba.rgb, vec3(0.0));
+    // reinhard on the luminance keeps the hue of bright colors instead of desaturating them per channel
+    if (tonemap_operator == TONEMAP_REINHARD) rgb /= 1.0 + luminance(rgb);
+    else if (tonemap_operator == TONEMAP_ACES) rgb = aces_film(rgb);
+    return pow(vec4(rgb, max(rgba.a, 0.0)), vec4(INV_GAMMA));
+}
@@ -0,0 +1,71 @@
+// state and queues of the wavefront path tracer
+// paths are indexed by their pixel, the queues contain the indices of the paths that are still active
+
+#define WAVEFRONT_GROUP_SIZE 256
+
+struct PathState {
+    vec3 origin;
+    // hero wavelength
+    uint wavelength;
+    vec3 dir;
+    uint rng_state;
+    vec4 attenuation;
+    vec4 emission;
+    // emission gathered before the first dispersive interaction
+    vec4 shared_emission;
+    float sensor_weight;
+    float path_depth;
+    float last_bsdf_pdf;
+    uint last_mrd_idx;
+    uint dispersed;
+};
+
+struct Hit {
+    float t;
+    int instance_id;
+    int geometry_idx;
+    int primitive_idx;
+    vec2 bary;
+};
+
+struct ShadowRay {
+    vec3 origin;
+    uint path;
+    vec3 target;
+    uint padding;
+    vec4 contribution;
+};
+
+layout(binding = 21) buffer PathStateBuffer { PathState path_states[]; };
+// t < 0 marks a miss
+layout(binding = 22) buffer HitBuffer { Hit hits[]; };
+// two queues of pixel count entries each, the input queue of a bounce is the output queue of the previous one
+layout(binding = 23) buffer RayQueueBuffer { uint ray_queues[]; };
+layout(binding = 24) buffer ShadowRayBuffer { ShadowRay shadow_rays[]; };
+// the dispatch arguments are read by vkCmdDispatchIndirect
+// all kernels of a bounce are dispatched indirectly, wf_connect disables all of them once all paths terminated
+layout(binding = 25) buffer WavefrontCounterBuffer {
+    uint ray_count[2];
+    uint shadow_count;
+    uint padding;
+    // extend, shade and connect of a bounce, every path emits at most one shadow ray, so connect uses the same size
+    uvec4 ray_dispatch;
+    // wf_prepare of the next bounce, enabled by wf_generate and disabled by wf_connect once the next ray queue is empty
+    uvec4 prepare_dispatch;
+};
+// number of bounces the paths of the submissions with this descriptor set needed, the host records at least this many
+layout(binding = 36) buffer BounceCountBuffer { uint bounce_count; };
+
+uint get_path_count()
+{
+    return pc.viewport_width * pc.viewport_height;
+}
+
+// path that is currently shaded, shadow rays add their contribution to it
+uint current_path;
+
+void connect_light(in vec3 pos, in vec3 dir, in vec3 light_pos, in vec4 contribution, inout vec4 emission)
+{
+    // every path emits at most one shadow ray per bounce, so the queue can not overflow
+    shadow_rays[atomicAdd(shadow_count, 1)] = ShadowRay(pos, current_path, light_pos, 0, contribution);
+}
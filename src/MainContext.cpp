@@ -1,17 +1,32 @@
 #include "MainContext.hpp"
 
+#include <algorithm>
+
 MainContext::MainContext() : vcc(vmc), wc(vmc, vcc, app_state) 
 {
+    app_state.headless = sc.is_cache_loaded() && sc.data.headless && sc.data.sample_count > 0;
+    if (app_state.headless)
+    {
+        // default aspect_ratio is 16:9
+        headless_frame_extent = (sc.data.frame_width > 0 && sc.data.frame_height > 0) ? vk::Extent2D(sc.data.frame_width, sc.data.frame_height) : vk::Extent2D(5120, 2880);
+        app_state.aspect_ratio = float(headless_frame_extent.width) / float(headless_frame_extent.height);
+        // in image coordinates, the first row is the top of the frame
+        headless_crop.offset = vk::Offset2D(std::min(sc.data.crop_x, headless_frame_extent.width - 1), std::min(sc.data.crop_y, headless_frame_extent.height - 1));
+        headless_crop.extent.width = headless_frame_extent.width - headless_crop.offset.x;
+        headless_crop.extent.height = headless_frame_extent.height - headless_crop.offset.y;
+        if (sc.data.crop_width > 0) headless_crop.extent.width = std::min(sc.data.crop_width, headless_crop.extent.width);
+        if (sc.data.crop_height > 0) headless_crop.extent.height = std::min(sc.data.crop_height, headless_crop.extent.height);
+        // the images and buffers of the path tracer only hold one tile
+        app_state.render_extent = headless_crop.extent;
+        if (sc.data.tile_size > 0) app_state.render_extent = vk::Extent2D(std::min(sc.data.tile_size, headless_crop.extent.width), std::min(sc.data.tile_size, headless_crop.extent.height));
+    }
     if (sc.is_cache_loaded())
     {
         app_state.cam = Camera(60.0f, app_state.aspect_ratio, sc.data.sensor_width, sc.data.focal_length, sc.data.exposure, sc.data.pos, sc.data.euler);
         app_state.cam.update();
-        app_state.headless = sc.data.headless && sc.data.sample_count > 0;
     }
     if (app_state.headless)
     {
-        // default aspect_ratio is 16:9
-        app_state.render_extent = vk::Extent2D(5120, 2880);
         vmc.construct();
     }
     else
@@ -194,19 +209,59 @@ void MainContext::dispatch_pressed_keys()
 void MainContext::run_headless()
 {
     wc.load_scene(sc.data.scene_name);
-    float progress = 0.0f;
+    app_state.adaptive_target_error = sc.data.target_error;
+    app_state.denoise = sc.data.denoise;
+    app_state.samples_per_dispatch = sc.data.samples_per_dispatch;
+    app_state.tonemap_operator = sc.data.tonemap_operator;
+    app_state.frame_extent = headless_frame_extent;
+    const vk::Extent2D tile_extent = app_state.render_extent;
+    const uint32_t tile_count_x = (headless_crop.extent.width + tile_extent.width - 1) / tile_extent.width;
+    const uint32_t tile_count = tile_count_x * ((headless_crop.extent.height + tile_extent.height - 1) / tile_extent.height);
+    // the tiles are copied into the crop rectangle on the host, so the size of the frame is not limited by the memory of the gpu
+    std::vector<unsigned char> framebuffer(std::size_t(headless_crop.extent.width) * headless_crop.extent.height * 4);
     uint32_t progress_percent = 0;
     ve::HostTimer timer;
-    for (uint32_t i = 0; i < sc.data.sample_count; ++i)
-    {
-        wc.headless_next_sample(app_state);
-        progress = float(i) / float(sc.data.sample_count);
-        if (progress * 100.0f >= progress_percent) std::cout << progress_percent++ << '\r' << std::flush;
+    for (uint32_t tile = 0; tile < tile_count; ++tile)
+    {
+        // position of the tile in the crop rectangle, in image coordinates
+        const uint32_t tile_x = (tile % tile_count_x) * tile_extent.width;
+        const uint32_t tile_y = (tile / tile_count_x) * tile_extent.height;
+        app_state.trace_extent = vk::Extent2D(std::min(tile_extent.width, headless_crop.extent.width - tile_x), std::min(tile_extent.height, headless_crop.extent.height - tile_y));
+        // the y axis of the frame points up, while the first row of the image is its top
+        app_state.frame_offset = vk::Offset2D(headless_crop.offset.x + tile_x, headless_frame_extent.height - (headless_crop.offset.y + tile_y) - app_state.trace_extent.height);
+        app_state.sample_count = 0;
+        // the remaining time is split evenly between the remaining tiles
+        const float tile_time_budget = (sc.data.time_budget_seconds - timer.elapsed()) / float(tile_count - tile);
+        ve::HostTimer tile_timer;
+        // the last submission may trace more samples than requested if the count is not a multiple of the samples per dispatch
+        while (app_state.sample_count < sc.data.sample_count)
+        {
+            wc.headless_next_sample(app_state);
+            const float progress = (float(tile) + float(app_state.sample_count) / float(sc.data.sample_count)) / float(tile_count);
+            while (progress * 100.0f >= progress_percent && progress_percent <= 100) std::cout << progress_percent++ << '\r' << std::flush;
+            // the count of active tiles lags one submission per descriptor set behind, so it is only valid once every pixel could have converged
+            if (app_state.adaptive_target_error > 0.0f && app_state.sample_count > app_state.adaptive_min_samples + ve::frames_in_flight * app_state.samples_per_dispatch && app_state.active_tile_count == 0)
+            {
+                spdlog::info("Tile {} converged after {} samples", tile, app_state.sample_count);
+                break;
+            }
+            if (sc.data.time_budget_seconds > 0.0f && tile_timer.elapsed() >= tile_time_budget)
+            {
+                spdlog::info("Time budget of tile {} exhausted after {} samples", tile, app_state.sample_count);
+                break;
+            }
+        }
+        const std::vector<unsigned char> tile_data = wc.headless_last_sample(app_state);
+        for (uint32_t y = 0; y < app_state.trace_extent.height; ++y)
+        {
+            const std::size_t src = std::size_t(y) * tile_extent.width * 4;
+            const std::size_t dst = (std::size_t(tile_y + y) * headless_crop.extent.width + tile_x) * 4;
+            std::copy_n(tile_data.begin() + src, app_state.trace_extent.width * 4, framebuffer.begin() + dst);
+        }
     }
     std::cout << std::endl;
     spdlog::info("Rendering took: {} ms", timer.elapsed<std::milli>());
-    app_state.save_screenshot = true;
-    wc.headless_next_sample(app_state);
+    ve::save_png(framebuffer, headless_crop.extent.width, headless_crop.extent.height);
 }
 
 void MainContext::run_ui()
@@ -249,11 +304,13 @@ void MainContext::run_ui()
         }
         app_state.time_diff = timer.restart();
         app_state.time += app_state.time_diff;
+        if (app_state.animate) app_state.animation_time += app_state.time_diff;
         if (app_state.load_scene)
         {
             app_state.load_scene = false;
             wc.load_scene(app_state.scene_names[app_state.current_scene]);
             app_state.sample_count = 0;
+            app_state.animation_time = 0.0f;
             timer.restart();
         }
     }
@@ -0,0 +1,177 @@
+#include "SampleTables.hpp"
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace ve
+{
+    namespace
+    {
+        // primitive polynomials and initial direction numbers of the dimensions 2 to 4 from Joe and Kuo
+        struct SobolPolynomial {
+            uint32_t degree;
+            uint32_t coefficients;
+            std::vector<uint32_t> m;
+        };
+
+        constexpr uint32_t blue_noise_pixel_count = blue_noise_size * blue_noise_size;
+
+        // gaussian energy of the void and cluster algorithm, the mask wraps around at the borders
+        class BlueNoiseEnergy
+        {
+        public:
+            BlueNoiseEnergy() : lut(blue_noise_pixel_count), energy(blue_noise_pixel_count, 0.0f)
+            {
+                constexpr float sigma = 1.5f;
+                for (uint32_t y = 0; y < blue_noise_size; ++y)
+                {
+                    for (uint32_t x = 0; x < blue_noise_size; ++x)
+                    {
+                        const float dx = std::min(x, blue_noise_size - x);
+                        const float dy = std::min(y, blue_noise_size - y);
+                        lut[y * blue_noise_size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+                    }
+                }
+            }
+
+            void splat(uint32_t idx, float sign)
+            {
+                const uint32_t px = idx % blue_noise_size;
+                const uint32_t py = idx / blue_noise_size;
+                for (uint32_t y = 0; y < blue_noise_size; ++y)
+                {
+                    const uint32_t dy = (y + blue_noise_size - py) % blue_noise_size;
+                    for (uint32_t x = 0; x < blue_noise_size; ++x)
+                    {
+                        const uint32_t dx = (x + blue_noise_size - px) % blue_noise_size;
+                        energy[y * blue_noise_size + x] += sign * lut[dy * blue_noise_size + dx];
+                    }
+                }
+            }
+
+            // pixel with the highest energy that has the given value in the pattern
+            uint32_t find_max(const std::vector<uint8_t>& pattern, uint8_t value) const
+            {
+                uint32_t best = 0;
+                float best_energy = -std::numeric_limits<float>::max();
+                for (uint32_t i = 0; i < blue_noise_pixel_count; ++i)
+                {
+                    if (pattern[i] == value && energy[i] > best_energy)
+                    {
+                        best_energy = energy[i];
+                        best = i;
+                    }
+                }
+                return best;
+            }
+
+            // pixel with the lowest energy that has the given value in the pattern
+            uint32_t find_min(const std::vector<uint8_t>& pattern, uint8_t value) const
+            {
+                uint32_t best = 0;
+                float best_energy = std::numeric_limits<float>::max();
+                for (uint32_t i = 0; i < blue_noise_pixel_count; ++i)
+                {
+                    if (pattern[i] == value && energy[i] < best_energy)
+                    {
+                        best_energy = energy[i];
+                        best = i;
+                    }
+                }
+                return best;
+            }
+
+        private:
+            std::vector<float> lut;
+            std::vector<float> energy;
+        };
+    } // namespace
+
+    std::vector<uint32_t> generate_sobol_matrices()
+    {
+        const std::vector<SobolPolynomial> polynomials{{1, 0, {1}}, {2, 1, {1, 3}}, {3, 1, {1, 3, 1}}};
+        std::vector<uint32_t> matrices(sobol_dimensions * 32);
+        // the first dimension is the van der corput sequence
+        for (uint32_t i = 0; i < 32; ++i) matrices[i] = 1u << (31 - i);
+        for (uint32_t d = 1; d < sobol_dimensions; ++d)
+        {
+            const SobolPolynomial& p = polynomials[d - 1];
+            uint32_t* v = matrices.data() + d * 32;
+            for (uint32_t i = 0; i < p.degree; ++i) v[i] = p.m[i] << (31 - i);
+            for (uint32_t i = p.degree; i < 32; ++i)
+            {
+                v[i] = v[i - p.degree] ^ (v[i - p.degree] >> p.degree);
+                for (uint32_t k = 1; k < p.degree; ++k) v[i] ^= ((p.coefficients >> (p.degree - 1 - k)) & 1) * v[i - k];
+            }
+        }
+        return matrices;
+    }
+
+    std::vector<float> generate_blue_noise()
+    {
+        // initial binary pattern with 10% of the pixels set, relaxed until no point moves anymore
+        std::vector<uint8_t> initial_pattern(blue_noise_pixel_count, 0);
+        BlueNoiseEnergy initial_energy;
+        std::mt19937 rng(0x5eed);
+        std::uniform_int_distribution<uint32_t> dist(0, blue_noise_pixel_count - 1);
+        const uint32_t initial_count = blue_noise_pixel_count / 10;
+        for (uint32_t i = 0; i < initial_count;)
+        {
+            const uint32_t idx = dist(rng);
+            if (initial_pattern[idx]) continue;
+            initial_pattern[idx] = 1;
+            initial_energy.splat(idx, 1.0f);
+            ++i;
+        }
+        for (uint32_t i = 0; i < blue_noise_pixel_count; ++i)
+        {
+            const uint32_t cluster = initial_energy.find_max(initial_pattern, 1);
+            initial_pattern[cluster] = 0;
+            initial_energy.splat(cluster, -1.0f);
+            const uint32_t void_idx = initial_energy.find_min(initial_pattern, 0);
+            initial_pattern[void_idx] = 1;
+            initial_energy.splat(void_idx, 1.0f);
+            if (void_idx == cluster) break;
+        }
+
+        std::vector<uint32_t> rank(blue_noise_pixel_count, 0);
+        // remove the points of the initial pattern from the tightest clusters first
+        std::vector<uint8_t> pattern = initial_pattern;
+        BlueNoiseEnergy energy = initial_energy;
+        for (uint32_t r = initial_count; r > 0; --r)
+        {
+            const uint32_t cluster = energy.find_max(pattern, 1);
+            pattern[cluster] = 0;
+            energy.splat(cluster, -1.0f);
+            rank[cluster] = r - 1;
+        }
+        // fill the largest voids until half of the pixels are set
+        pattern = initial_pattern;
+        energy = initial_energy;
+        for (uint32_t r = initial_count; r < blue_noise_pixel_count / 2; ++r)
+        {
+            const uint32_t void_idx = energy.find_min(pattern, 0);
+            pattern[void_idx] = 1;
+            energy.splat(void_idx, 1.0f);
+            rank[void_idx] = r;
+        }
+        // the unset pixels are the minority now, so the tightest clusters of them are filled
+        BlueNoiseEnergy zero_energy;
+        for (uint32_t i = 0; i < blue_noise_pixel_count; ++i)
+        {
+            if (!pattern[i]) zero_energy.splat(i, 1.0f);
+        }
+        for (uint32_t r = blue_noise_pixel_count / 2; r < blue_noise_pixel_count; ++r)
+        {
+            const uint32_t cluster = zero_energy.find_max(pattern, 0);
+            pattern[cluster] = 1;
+            zero_energy.splat(cluster, -1.0f);
+            rank[cluster] = r;
+        }
+
+        std::vector<float> mask(blue_noise_pixel_count);
+        for (uint32_t i = 0; i < blue_noise_pixel_count; ++i) mask[i] = (float(rank[i]) + 0.5f) / float(blue_noise_pixel_count);
+        return mask;
+    }
+} // namespace ve
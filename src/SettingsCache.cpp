@@ -26,6 +26,19 @@ std::istream& operator>>(std::istream& is, SettingsCache::Data& data)
     data.sensor_width = std::stof(get());
     data.focal_length = std::stof(get());
     data.exposure = std::stof(get());
+    // optional, older caches end here
+    data.target_error = get().empty() ? 0.0f : std::stof(buffer);
+    data.time_budget_seconds = get().empty() ? 0.0f : std::stof(buffer);
+    data.denoise = get() == "1";
+    data.samples_per_dispatch = get().empty() ? 1 : std::stoi(buffer);
+    data.tile_size = get().empty() ? 0 : std::stoi(buffer);
+    data.frame_width = get().empty() ? 0 : std::stoi(buffer);
+    data.frame_height = get().empty() ? 0 : std::stoi(buffer);
+    data.crop_x = get().empty() ? 0 : std::stoi(buffer);
+    data.crop_y = get().empty() ? 0 : std::stoi(buffer);
+    data.crop_width = get().empty() ? 0 : std::stoi(buffer);
+    data.crop_height = get().empty() ? 0 : std::stoi(buffer);
+    data.tonemap_operator = get().empty() ? 0 : std::stoi(buffer);
     return is;
 }
 
@@ -44,6 +57,18 @@ std::ostream& operator<<(std::ostream& os, const SettingsCache::Data& data)
     print_float(data.sensor_width);
     print_float(data.focal_length);
     print_float(data.exposure);
+    print_float(data.target_error);
+    print_float(data.time_budget_seconds);
+    os << data.denoise << '\n';
+    os << data.samples_per_dispatch << '\n';
+    os << data.tile_size << '\n';
+    os << data.frame_width << '\n';
+    os << data.frame_height << '\n';
+    os << data.crop_x << '\n';
+    os << data.crop_y << '\n';
+    os << data.crop_width << '\n';
+    os << data.crop_height << '\n';
+    os << data.tonemap_operator << '\n';
     return os;
 }
 
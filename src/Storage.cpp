@@ -88,6 +88,11 @@ namespace ve
         return get_buffer(buffer_names.at(name));
     }
 
+    bool Storage::has_buffer(const std::string& name) const
+    {
+        return buffer_names.contains(name) && buffers.at(buffer_names.at(name)).has_value();
+    }
+
     Image& Storage::get_image_by_name(const std::string& name)
     {
         return get_image(image_names.at(name));
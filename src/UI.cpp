@@ -109,6 +109,8 @@ namespace ve
         app_state.cam.data.sensor_size.y = app_state.cam.data.sensor_size.x / app_state.aspect_ratio;
         ImGui::DragFloat("Camera focal length", &app_state.cam.data.focal_length, 0.001f, 0.001f, 0.5f);
         ImGui::DragFloat("Exposure", &app_state.cam.data.exposure, 0.1f, 0.0f, 50.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        const char* tonemap_operator_names[] = {"Clamp", "Reinhard", "ACES"};
+        ImGui::Combo("Tonemap operator", &app_state.tonemap_operator, tonemap_operator_names, IM_ARRAYSIZE(tonemap_operator_names));
         app_state.bin_count_changed |= ImGui::SliderInt("Bin count", &app_state.bin_count_per_channel, 1, 512);
         ImGui::SliderInt("Histogram update rate", &app_state.histogram_update_rate, 1, 512);
         if (ImPlot::BeginPlot("Histogram"))
@@ -142,6 +144,25 @@ namespace ve
         ImGui::TextColored(ImVec4(0.0, 1.0, 0.0, 1.0), "Path Tracing");
         ImGui::Checkbox("Accumulate samples", &app_state.accumulate_samples);
         ImGui::Checkbox("Force accumulate samples", &app_state.force_accumulate_samples);
+        ImGui::Checkbox("Half precision accumulation", &app_state.half_precision_accumulation);
+        ImGui::Checkbox("Reproject samples", &app_state.reproject);
+        ImGui::Checkbox("Dynamic resolution", &app_state.dynamic_resolution);
+        if (app_state.dynamic_resolution)
+        {
+            float frame_time_budget_ms = app_state.frame_time_budget * 1000.0f;
+            if (ImGui::DragFloat("Sample time budget (ms)", &frame_time_budget_ms, 0.5f, 1.0f, 1000.0f)) app_state.frame_time_budget = frame_time_budget_ms / 1000.0f;
+            ImGui::SliderFloat("Motion resolution scale", &app_state.motion_resolution_scale, app_state.min_resolution_scale, 1.0f);
+            ImGui::Text((std::string("Trace resolution: ") + std::to_string(app_state.trace_extent.width) + "x" + std::to_string(app_state.trace_extent.height)).c_str());
+        }
+        ImGui::Checkbox("Animate", &app_state.animate);
+        ImGui::Checkbox("Wavefront", &app_state.wavefront);
+        const char* sampler_names[] = {"PCG", "Sobol", "Blue noise"};
+        // samples of different samplers must not be mixed
+        if (ImGui::Combo("Sampler", &app_state.sampler, sampler_names, IM_ARRAYSIZE(sampler_names))) app_state.sample_count = 0;
+        ImGui::DragFloat("Adaptive target error", &app_state.adaptive_target_error, 0.001f, 0.0f, 1.0f, "%.4f");
+        ImGui::Checkbox("Denoise", &app_state.denoise);
+        if (app_state.denoise) ImGui::SliderInt("Denoise iterations", &app_state.denoise_iterations, 1, 8);
+        if (app_state.adaptive_target_error > 0.0f) ImGui::Text((std::string("Active tiles: ") + std::to_string(app_state.active_tile_count)).c_str());
         ImGui::Text((std::string("VSync: ") + (app_state.vsync ? std::string("on") : std::string("off"))).c_str());
         ImGui::Text((std::string("Sample count: ") + std::to_string(app_state.sample_count)).c_str());
         time_diff = time_diff * (1 - update_weight) + app_state.time_diff * update_weight;
@@ -1,10 +1,19 @@
 #include "WorkContext.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 
 namespace ve
 {
-    WorkContext::WorkContext(const VulkanMainContext& vmc, VulkanCommandContext& vcc, AppState& app_state) : vmc(vmc), vcc(vcc), storage(vmc, vcc), scene(vmc, vcc, storage), path_tracer(vmc, storage)
+    // the reduced resolution is kept for a moment after the last motion, so short pauses in the input do not discard the accumulated samples twice
+    constexpr float resolution_restore_delay = 0.1f;
+    // the resolution scale changes in coarse steps, as every change discards the accumulated samples
+    constexpr float resolution_scale_steps = 8.0f;
+    // the samples of a submission are only shown once all of its dispatches finished
+    constexpr uint32_t max_dispatches_per_submission = 32;
+
+    WorkContext::WorkContext(const VulkanMainContext& vmc, VulkanCommandContext& vcc, AppState& app_state) : vmc(vmc), vcc(vcc), storage(vmc, vcc), scene(vmc, vcc, storage), path_tracer(vmc, storage), denoiser(vmc, storage), tonemapper(vmc, storage)
     {}
 
     void WorkContext::construct(AppState& app_state)
@@ -17,12 +26,15 @@ namespace ve
             histogram.emplace(vmc, storage);
         }
         vcc.add_graphics_buffers(frames_in_flight);
-        vcc.add_compute_buffers(1);
+        // one command buffer per descriptor set of the path tracer, headless mode keeps them recorded
+        vcc.add_compute_buffers(frames_in_flight);
         vcc.add_transfer_buffers(1);
+        app_state.trace_extent = app_state.render_extent;
+        app_state.frame_extent = app_state.render_extent;
         path_tracer.setup_storage(app_state);
+        denoiser.setup_storage(app_state);
         if (!app_state.headless)
         {
-            renderer->setup_storage(app_state);
             histogram->setup_storage(app_state);
             swapchain->construct(app_state.vsync);
             app_state.window_extent = swapchain->get_extent();
@@ -33,16 +45,32 @@ namespace ve
             timers.emplace_back(vmc, vcc);
             syncs.emplace_back(vmc.logical_device.get());
         }
+        if (!app_state.headless)
+        {
+            for (uint32_t i = 0; i < frames_in_flight; ++i) compute_timers.emplace_back(vmc, vcc);
+            compute_timeline.emplace(vmc.logical_device.get());
+            display_timeline.emplace(vmc.logical_device.get());
+            display_extents.fill(app_state.trace_extent);
+        }
 
-        // set up uniform buffer
-        uniform_buffer = storage.add_named_buffer("uniform_buffer", sizeof(Camera::Data), vk::BufferUsageFlagBits::eUniformBuffer, false, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer);
+        // set up uniform buffers, one per descriptor set
         app_state.cam.update_data();
-        storage.get_buffer(uniform_buffer).update_data_bytes(&app_state.cam.data, sizeof(Camera::Data));
+        old_cam_data = app_state.cam.data;
+        previous_cam_data = app_state.cam.data;
+        for (uint32_t i = 0; i < frames_in_flight; ++i)
+        {
+            uniform_buffers.push_back(storage.add_named_buffer("uniform_buffer_" + std::to_string(i), sizeof(Camera::Data), vk::BufferUsageFlagBits::eUniformBuffer, false, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer));
+            storage.get_buffer(uniform_buffers.back()).update_data_bytes(&app_state.cam.data, sizeof(Camera::Data));
+            previous_uniform_buffers.push_back(storage.add_named_buffer("previous_uniform_buffer_" + std::to_string(i), sizeof(Camera::Data), vk::BufferUsageFlagBits::eUniformBuffer, false, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer));
+            storage.get_buffer(previous_uniform_buffers.back()).update_data_bytes(&app_state.cam.data, sizeof(Camera::Data));
+        }
 
         path_tracer.construct(vcc);
+        denoiser.construct();
+        tonemapper.construct();
         if (!app_state.headless)
         {
-            renderer->construct(swapchain->get_render_pass());
+            renderer->construct(swapchain->get_render_pass(), path_tracer.get_images());
             histogram->construct(app_state);
         }
 
@@ -54,14 +82,23 @@ namespace ve
         vmc.logical_device.get().waitIdle();
         for (auto& sync : syncs) sync.destruct();
         syncs.clear();
+        if (compute_timeline.has_value()) compute_timeline->destruct();
+        if (display_timeline.has_value()) display_timeline->destruct();
         for (auto& timer : timers) timer.destruct();
         timers.clear();
-        storage.destroy_buffer(uniform_buffer);
+        for (auto& timer : compute_timers) timer.destruct();
+        compute_timers.clear();
+        for (uint32_t i : uniform_buffers) storage.destroy_buffer(i);
+        uniform_buffers.clear();
+        for (uint32_t i : previous_uniform_buffers) storage.destroy_buffer(i);
+        previous_uniform_buffers.clear();
         if (ui.has_value()) ui->destruct();
         scene.destruct();
         if (swapchain.has_value()) swapchain->destruct();
         if (renderer.has_value()) renderer->destruct();
         if (histogram.has_value()) histogram->destruct();
+        tonemapper.destruct();
+        denoiser.destruct();
         path_tracer.destruct();
         spdlog::info("Destroyed WorkContext");
     }
@@ -70,6 +107,8 @@ namespace ve
     {
         vmc.logical_device.get().waitIdle();
         path_tracer.reload_shaders();
+        denoiser.reload_shaders();
+        tonemapper.reload_shaders();
     }
 
     void WorkContext::load_scene(const std::string& filename)
@@ -81,28 +120,48 @@ namespace ve
         scene.load(std::string("../assets/scenes/") + filename);
         scene.construct();
         spdlog::info("Loading scene took: {} ms", (timer.elapsed<std::milli>()));
-        path_tracer.set_scene(scene.get_texture_image_count(), init);
+        path_tracer.set_scene(scene.get_texture_image_count(), scene.get_emissive_triangle_count(), scene.get_punctual_light_count(), init);
     }
 
     void WorkContext::headless_next_sample(AppState& app_state)
     {
-        syncs[0].wait_for_fence(Synchronization::F_COMPUTE_FINISHED);
-        syncs[0].reset_fence(Synchronization::F_COMPUTE_FINISHED);
-        uint32_t read_only_image = app_state.sample_count % frames_in_flight;
+        submit_headless_sample(app_state, false);
+    }
 
-        vk::CommandBuffer& compute_cb = vcc.begin(vcc.compute_cbs[0]);
-        path_tracer.compute(compute_cb, app_state, read_only_image);
-        compute_cb.end();
-        vk::SubmitInfo compute_si(0, nullptr, nullptr, 1, &vcc.compute_cbs[0]);
-        vmc.get_compute_queue().submit(compute_si, syncs[0].get_fence(Synchronization::F_COMPUTE_FINISHED));
+    std::vector<unsigned char> WorkContext::headless_last_sample(AppState& app_state)
+    {
+        const uint32_t read_only_image = submit_headless_sample(app_state, true);
+        syncs[read_only_image].wait_for_fence(Synchronization::F_COMPUTE_FINISHED);
+        // the next tile traces another region, so the commands of all descriptor sets are recorded again
+        headless_cbs_recorded.fill(false);
+        return storage.get_image_by_name("path_trace_image_0").obtain_data(vcc);
+    }
 
-        if (app_state.save_screenshot)
+    uint32_t WorkContext::submit_headless_sample(AppState& app_state, bool last_sample)
+    {
+        // consecutive submissions alternate between the descriptor sets, each of them has its own command buffer and fence
+        // so the next submission is already queued while the previous one is traced
+        const uint32_t read_only_image = headless_submission_count++ % frames_in_flight;
+        const Synchronization& sync = syncs[read_only_image];
+        sync.wait_for_fence(Synchronization::F_COMPUTE_FINISHED);
+        sync.reset_fence(Synchronization::F_COMPUTE_FINISHED);
+
+        vk::CommandBuffer& compute_cb = vcc.compute_cbs[read_only_image];
+        path_tracer.prepare_sample(app_state, read_only_image);
+        // the settings do not change within a tile, so the commands are only recorded once, except for the last sample which is the only one that writes the output image
+        if (last_sample || !headless_cbs_recorded[read_only_image] || path_tracer.needs_recording(read_only_image))
         {
-            // save image that was the target in the last iteration
-            storage.get_image_by_name("path_trace_image_" + std::to_string(1 - read_only_image)).save_to_file(vcc);
-            app_state.save_screenshot = false;
+            vcc.begin(compute_cb, {});
+            path_tracer.record_sample(compute_cb, app_state, read_only_image);
+            // only the last sample is resolved, so a single output image is enough
+            if (last_sample) resolve_image(compute_cb, app_state, 0);
+            compute_cb.end();
+            headless_cbs_recorded[read_only_image] = !last_sample;
         }
-        app_state.sample_count++;
+        vk::SubmitInfo compute_si(0, nullptr, nullptr, 1, &compute_cb);
+        vmc.get_compute_queue().submit(compute_si, sync.get_fence(Synchronization::F_COMPUTE_FINISHED));
+        app_state.sample_count += path_tracer.get_samples_per_pixel();
+        return read_only_image;
     }
 
     void WorkContext::draw_frame(AppState& app_state)
@@ -111,27 +170,64 @@ namespace ve
         syncs[app_state.current_frame].reset_fence(Synchronization::F_RENDER_FINISHED);
         vk::ResultValue<uint32_t> image_idx = vmc.logical_device.get().acquireNextImageKHR(swapchain->get(), uint64_t(-1), syncs[app_state.current_frame].get_semaphore(Synchronization::S_IMAGE_AVAILABLE));
         VE_CHECK(image_idx.result, "Failed to acquire next image!");
-        if (app_state.current_frame == 0)
+        // the batches grow while the compute queue runs dry between two frames and shrink while it does not finish a single submission per frame
+        const uint64_t previous_in_flight = compute_submission_count - compute_timeline->get_value();
+        if (previous_in_flight == 0 && compute_submission_count > 0) dispatches_per_submission = std::min(dispatches_per_submission * 2, max_dispatches_per_submission);
+        else if (previous_in_flight == frames_in_flight) dispatches_per_submission = std::max(dispatches_per_submission / 2, 1u);
+        app_state.cam.update_data();
+        const bool camera_moved = old_cam_data != app_state.cam.data;
+        if (!app_state.force_accumulate_samples)
+        {
+            if (!app_state.accumulate_samples) app_state.sample_count = 0;
+            else if (camera_moved)
+            {
+                if (app_state.reproject) app_state.reproject_history = true;
+                else app_state.sample_count = 0;
+            }
+        }
+        if (camera_moved || instances_moved) last_motion_time = app_state.time;
+        // the pixels of different resolutions do not match, so nothing can be accumulated or reprojected across a change
+        if (update_trace_extent(app_state, last_motion_time >= 0.0f && app_state.time - last_motion_time < resolution_restore_delay))
+        {
+            app_state.sample_count = 0;
+            app_state.reproject_history = false;
+        }
+        if (camera_moved)
         {
-            app_state.cam.update_data();
-            if (!app_state.force_accumulate_samples && (old_cam_data != app_state.cam.data || !app_state.accumulate_samples)) app_state.sample_count = 0;
+            // the camera of the accumulated samples is needed to reproject them
+            previous_cam_data = old_cam_data;
             old_cam_data = app_state.cam.data;
-            syncs[0].wait_for_fence(Synchronization::F_COMPUTE_FINISHED);
-            syncs[0].reset_fence(Synchronization::F_COMPUTE_FINISHED);
-            storage.get_buffer(uniform_buffer).update_data_bytes(&app_state.cam.data, sizeof(Camera::Data));
+        }
+        if (app_state.bin_count_changed)
+        {
+            wait_for_compute();
+            app_state.bin_count_changed = false;
+            histogram->destruct();
+            histogram->setup_storage(app_state);
+            histogram->construct(app_state);
+            histogram_submission = 0;
         }
         for (uint32_t i = 0; i < DeviceTimer::TIMER_COUNT && app_state.current_frame > timers.size(); ++i)
         {
             double timing = timers[app_state.current_frame].get_result_by_idx(i);
             app_state.devicetimings[i] = timing;
         }
-        uint32_t read_only_image = (app_state.total_frames / frames_in_flight) % frames_in_flight;
+
+        // the compute queue is kept busy with frames_in_flight submissions, independent of the rate at which the frames are presented
+        const uint64_t in_flight = compute_submission_count - compute_timeline->get_value();
+        instances_moved = false;
+        for (uint64_t i = in_flight; i < frames_in_flight; ++i) submit_sample(app_state, i == in_flight);
+
+        // the newest finished submission is shown, its image is not written again before this frame finished
+        const uint64_t shown_submission = compute_timeline->get_value();
         if (app_state.save_screenshot)
         {
-            storage.get_image_by_name("path_trace_image_" + std::to_string(read_only_image)).save_to_file(vcc);
+            // outside of the traced region the image still contains earlier traces at a larger resolution
+            const uint32_t shown_image = shown_submission % display_image_count;
+            storage.get_image_by_name("path_trace_image_" + std::to_string(shown_image)).save_to_file(vcc, display_extents[shown_image]);
             app_state.save_screenshot = false;
         }
-        render(image_idx.value, read_only_image, app_state);
+        render(image_idx.value, shown_submission, app_state);
         app_state.current_frame = (app_state.current_frame + 1) % frames_in_flight;
         app_state.total_frames++;
     }
@@ -143,46 +239,125 @@ namespace ve
         return swapchain->get_extent();
     }
 
-    void WorkContext::render(uint32_t image_idx, uint32_t read_only_image, AppState& app_state)
+    bool WorkContext::update_trace_extent(AppState& app_state, bool moving)
     {
-        if (app_state.current_frame == 0)
+        float scale = 1.0f;
+        if (app_state.dynamic_resolution && moving)
         {
-            vk::CommandBuffer& compute_cb = vcc.begin(vcc.compute_cbs[0]);
-            path_tracer.compute(compute_cb, app_state, read_only_image);
-            if (app_state.bin_count_changed)
-            {
-                app_state.bin_count_changed = false;
-                histogram->destruct();
-                histogram->setup_storage(app_state);
-                histogram->construct(app_state);
-            }
-            if (app_state.sample_count % app_state.histogram_update_rate == 0) histogram->compute(compute_cb, app_state, read_only_image);
-            compute_cb.end();
-            app_state.sample_count++;
+            // the frames are presented independent of the path tracer, so its measured gpu time decides how many pixels fit into the budget
+            // the cost of a sample is roughly proportional to the pixel count, so both dimensions follow the square root of the ratio to the budget
+            scale = app_state.motion_resolution_scale;
+            if (pixel_trace_time > 0.0) scale = std::sqrt(app_state.frame_time_budget / (pixel_trace_time * app_state.render_extent.width * app_state.render_extent.height));
+            scale = std::ceil(scale * resolution_scale_steps) / resolution_scale_steps;
+            scale = std::clamp(scale, app_state.min_resolution_scale, std::max(app_state.motion_resolution_scale, app_state.min_resolution_scale));
         }
+        app_state.resolution_scale = scale;
+        const vk::Extent2D trace_extent(std::max(uint32_t(app_state.render_extent.width * scale), 1u), std::max(uint32_t(app_state.render_extent.height * scale), 1u));
+        if (trace_extent == app_state.trace_extent) return false;
+        app_state.trace_extent = trace_extent;
+        app_state.frame_extent = trace_extent;
+        return true;
+    }
 
+    void WorkContext::resolve_image(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx)
+    {
+        // the denoiser writes the image itself, the tonemapper resolves everything that it leaves out
+        if (!app_state.denoise || !denoiser.compute(cb, app_state, image_idx)) tonemapper.compute(cb, app_state, image_idx);
+    }
+
+    void WorkContext::submit_sample(AppState& app_state, bool update_scene)
+    {
+        const uint64_t submission = ++compute_submission_count;
+        // the submissions in flight alternate between the descriptor sets and command buffers and rotate through the output images
+        const uint32_t read_only_image = submission % frames_in_flight;
+        const uint32_t image = submission % display_image_count;
+        // the command buffer, the timer and the host visible buffers of the set are reused once its last submission finished
+        if (submission > frames_in_flight)
+        {
+            compute_timeline->wait(submission - frames_in_flight);
+            const TimedTrace& timed = timed_traces[read_only_image];
+            const double trace_time = compute_timers[read_only_image].get_result_by_idx<std::ratio<1, 1>>(DeviceTimer::PATH_TRACE);
+            if (trace_time > 0.0) pixel_trace_time = trace_time / (double(timed.dispatch_count) * timed.extent.width * timed.extent.height);
+        }
+        // new buffers are bound to all descriptor sets
+        if (path_tracer.needs_storage_update(app_state)) wait_for_compute();
+
+        storage.get_buffer(uniform_buffers[read_only_image]).update_data_bytes(&old_cam_data, sizeof(Camera::Data));
+        storage.get_buffer(previous_uniform_buffers[read_only_image]).update_data_bytes(&previous_cam_data, sizeof(Camera::Data));
+
+        vk::CommandBuffer& compute_cb = vcc.begin(vcc.compute_cbs[read_only_image]);
+        if (update_scene)
+        {
+            // moving instances invalidate all accumulated samples
+            instances_moved = app_state.animate && scene.update(compute_cb, app_state.animation_time, read_only_image);
+            if (instances_moved) app_state.sample_count = 0;
+        }
+        scene.update_transforms(read_only_image);
+        if (path_tracer.update_accumulation_buffers(app_state))
+        {
+            denoiser.update_descriptors();
+            tonemapper.update_descriptors();
+        }
+        path_tracer.prepare_sample(app_state, read_only_image);
+        // a restarted accumulation is shown as soon as possible
+        const uint32_t dispatch_count = app_state.sample_count == 0 ? 1 : dispatches_per_submission;
+        compute_timers[read_only_image].reset(compute_cb, {DeviceTimer::PATH_TRACE});
+        compute_timers[read_only_image].start(compute_cb, DeviceTimer::PATH_TRACE, vk::PipelineStageFlagBits::eComputeShader);
+        path_tracer.record_sample(compute_cb, app_state, read_only_image, dispatch_count);
+        compute_timers[read_only_image].stop(compute_cb, DeviceTimer::PATH_TRACE, vk::PipelineStageFlagBits::eComputeShader);
+        timed_traces[read_only_image] = TimedTrace{dispatch_count, app_state.trace_extent};
+        app_state.reproject_history = false;
+        resolve_image(compute_cb, app_state, image);
+        display_extents[image] = app_state.trace_extent;
+        if ((app_state.sample_count < histogram_sample_count || app_state.sample_count >= histogram_sample_count + app_state.histogram_update_rate) && compute_timeline->get_value() >= histogram_submission)
+        {
+            histogram->compute(compute_cb, app_state, image);
+            histogram_submission = submission;
+            histogram_sample_count = app_state.sample_count;
+        }
+        compute_cb.end();
+        app_state.sample_count += path_tracer.get_samples_per_pixel() * dispatch_count;
+
+        // the image is written again once the last frame that showed it finished
+        const vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eComputeShader;
+        const uint64_t wait_value = image_display_values[image];
+        vk::TimelineSemaphoreSubmitInfo tssi(1, &wait_value, 1, &submission);
+        vk::SubmitInfo compute_si(1, &display_timeline->get(), &wait_stage, 1, &compute_cb, 1, &compute_timeline->get());
+        compute_si.pNext = &tssi;
+        vmc.get_compute_queue().submit(compute_si);
+    }
+
+    void WorkContext::wait_for_compute() const
+    {
+        compute_timeline->wait(compute_submission_count);
+    }
+
+    void WorkContext::render(uint32_t image_idx, uint64_t shown_submission, AppState& app_state)
+    {
+        const uint32_t display_image = shown_submission % display_image_count;
         vk::CommandBuffer& cb = vcc.begin(vcc.graphics_cbs[app_state.current_frame]);
         timers[app_state.current_frame].reset(cb, {DeviceTimer::RENDERING_ALL});
         timers[app_state.current_frame].start(cb, DeviceTimer::RENDERING_ALL, vk::PipelineStageFlagBits::eAllGraphics);
-        renderer->render(cb, app_state, read_only_image, swapchain->get_framebuffer(image_idx), swapchain->get_render_pass().get());
+        renderer->render(cb, app_state, display_image, display_extents[display_image], swapchain->get_framebuffer(image_idx), swapchain->get_render_pass().get());
         if (app_state.show_ui) ui->draw(cb, app_state);
         cb.endRenderPass();
         timers[app_state.current_frame].stop(cb, DeviceTimer::RENDERING_ALL, vk::PipelineStageFlagBits::eAllGraphics);
         cb.end();
 
         // submission
-        if (app_state.current_frame == 0)
-        {
-            vk::SubmitInfo compute_si(0, nullptr, nullptr, 1, &vcc.compute_cbs[0]);
-            vmc.get_compute_queue().submit(compute_si, syncs[0].get_fence(Synchronization::F_COMPUTE_FINISHED));
-        }
-
-        std::vector<vk::Semaphore> render_wait_semaphores;
-        std::vector<vk::PipelineStageFlags> render_wait_stages;
-        render_wait_semaphores.push_back(syncs[app_state.current_frame].get_semaphore(Synchronization::S_IMAGE_AVAILABLE));
-        render_wait_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-        vk::SubmitInfo render_si(render_wait_semaphores.size(), render_wait_semaphores.data(), render_wait_stages.data(), 1, &vcc.graphics_cbs[app_state.current_frame], 1, &syncs[app_state.current_frame].get_semaphore(Synchronization::S_RENDER_FINISHED));
+        // the compute submission that resolved the image has already finished, waiting for it makes its writes visible to the fragment shader
+        const std::array<vk::Semaphore, 2> render_wait_semaphores{syncs[app_state.current_frame].get_semaphore(Synchronization::S_IMAGE_AVAILABLE), compute_timeline->get()};
+        const std::array<vk::PipelineStageFlags, 2> render_wait_stages{vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eFragmentShader};
+        // the values of binary semaphores are ignored
+        const std::array<uint64_t, 2> render_wait_values{0, shown_submission};
+        const uint64_t display_value = ++display_submission_count;
+        const std::array<vk::Semaphore, 2> render_signal_semaphores{syncs[app_state.current_frame].get_semaphore(Synchronization::S_RENDER_FINISHED), display_timeline->get()};
+        const std::array<uint64_t, 2> render_signal_values{0, display_value};
+        vk::TimelineSemaphoreSubmitInfo tssi(render_wait_values.size(), render_wait_values.data(), render_signal_values.size(), render_signal_values.data());
+        vk::SubmitInfo render_si(render_wait_semaphores.size(), render_wait_semaphores.data(), render_wait_stages.data(), 1, &vcc.graphics_cbs[app_state.current_frame], render_signal_semaphores.size(), render_signal_semaphores.data());
+        render_si.pNext = &tssi;
         vmc.get_graphics_queue().submit(render_si, syncs[app_state.current_frame].get_fence(Synchronization::F_RENDER_FINISHED));
+        image_display_values[display_image] = display_value;
 
         vk::PresentInfoKHR present_info(1, &syncs[app_state.current_frame].get_semaphore(Synchronization::S_RENDER_FINISHED), 1, &swapchain->get(), &image_idx);
         VE_CHECK(vmc.get_present_queue().presentKHR(present_info), "Failed to present image!");
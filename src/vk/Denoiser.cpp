@@ -0,0 +1,89 @@
+#include "vk/Denoiser.hpp"
+
+namespace ve
+{
+    Denoiser::Denoiser(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, display_image_count)
+    {}
+
+    void Denoiser::setup_storage(AppState& app_state)
+    {
+        // two halves to ping-pong between the iterations, each pixel stores a vec4
+        denoise_buffer = storage.add_named_buffer("denoise_buffer", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * 2 * 16, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute);
+    }
+
+    void Denoiser::construct()
+    {
+        create_descriptor_set();
+        create_pipeline();
+    }
+
+    void Denoiser::destruct()
+    {
+        storage.destroy_buffer(denoise_buffer);
+        pipeline.destruct();
+        dsh.destruct();
+    }
+
+    void Denoiser::reload_shaders()
+    {
+        pipeline.destruct();
+        create_pipeline();
+    }
+
+    bool Denoiser::compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx)
+    {
+        // the debug views are shown as they are
+        if (app_state.attenuation_view || app_state.emission_view || app_state.normal_view || app_state.tex_view || app_state.path_depth_view) return false;
+        // every iteration reads the neighbors written by the previous one
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+        cb.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[image_idx], {});
+        dpc.iteration_count = app_state.denoise_iterations;
+        dpc.exposure = app_state.cam.data.exposure;
+        dpc.tonemap_operator = app_state.tonemap_operator;
+        dpc.viewport_width = app_state.trace_extent.width;
+        dpc.viewport_height = app_state.trace_extent.height;
+        dpc.half_precision_accumulation = app_state.half_precision_accumulation;
+        for (dpc.iteration = 0; dpc.iteration < dpc.iteration_count; ++dpc.iteration)
+        {
+            cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(DenoisePushConstants), &dpc);
+            cb.dispatch((app_state.trace_extent.width + 31) / 32, (app_state.trace_extent.height + 31) / 32, 1);
+            cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+        }
+        return true;
+    }
+
+    void Denoiser::update_descriptors()
+    {
+        dsh.reset_descriptors();
+        add_descriptors();
+        dsh.update();
+    }
+
+    void Denoiser::create_pipeline()
+    {
+        pipeline.construct(dsh.get_layouts()[0], ShaderInfo{"denoise.comp", vk::ShaderStageFlagBits::eCompute}, sizeof(DenoisePushConstants));
+    }
+
+    void Denoiser::create_descriptor_set()
+    {
+        for (uint32_t i = 0; i < 4; ++i) dsh.add_binding(i, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(4, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute);
+        add_descriptors();
+        dsh.construct();
+    }
+
+    void Denoiser::add_descriptors()
+    {
+        for (uint32_t i = 0; i < display_image_count; ++i)
+        {
+            // the set i writes the output image i of the path tracer
+            dsh.add_descriptor(i, 0, storage.get_buffer_by_name("accumulation_buffer"));
+            dsh.add_descriptor(i, 1, storage.get_buffer_by_name("aov_buffer"));
+            dsh.add_descriptor(i, 2, storage.get_buffer_by_name("pixel_stats"));
+            dsh.add_descriptor(i, 3, storage.get_buffer(denoise_buffer));
+            dsh.add_descriptor(i, 4, storage.get_image_by_name("path_trace_image_" + std::to_string(i)));
+        }
+    }
+} // namespace ve
@@ -5,17 +5,17 @@ namespace ve
     DescriptorSetHandler::DescriptorSetHandler(const VulkanMainContext& vmc, uint32_t set_count) : vmc(vmc), set_count(set_count)
     {}
 
-    void DescriptorSetHandler::add_binding(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count)
+    void DescriptorSetHandler::add_binding(uint32_t binding, vk::DescriptorType type, vk::ShaderStageFlags stages, uint32_t descriptor_count, vk::DescriptorBindingFlags binding_flags)
     {
         for (auto i = descriptors.begin(); i != descriptors.end(); ++i)
         {
             if (i->dslb.binding > binding)
             {
-                descriptors.insert(i, Descriptor(binding, type, stages, descriptor_count, set_count));
+                descriptors.insert(i, Descriptor(binding, type, stages, descriptor_count, binding_flags, set_count));
                 return;
             }
         }
-        descriptors.push_back(Descriptor(binding, type, stages, descriptor_count, set_count));
+        descriptors.push_back(Descriptor(binding, type, stages, descriptor_count, binding_flags, set_count));
     }
 
     void DescriptorSetHandler::add_descriptor(uint32_t set, uint32_t binding, const std::vector<Buffer>& buffers)
@@ -60,27 +60,42 @@ namespace ve
     void DescriptorSetHandler::construct()
     {
         std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
-        for (const auto d : descriptors) layout_bindings.push_back(d.dslb);
+        std::vector<vk::DescriptorBindingFlags> binding_flags;
+        bool update_after_bind = false;
+        for (const auto d : descriptors)
+        {
+            layout_bindings.push_back(d.dslb);
+            binding_flags.push_back(d.binding_flags);
+            update_after_bind |= bool(d.binding_flags & vk::DescriptorBindingFlagBits::eUpdateAfterBind);
+        }
+        vk::DescriptorSetLayoutBindingFlagsCreateInfo dslbfci{};
+        dslbfci.sType = vk::StructureType::eDescriptorSetLayoutBindingFlagsCreateInfo;
+        dslbfci.bindingCount = binding_flags.size();
+        dslbfci.pBindingFlags = binding_flags.data();
         for (uint32_t i = 0; i < set_count; ++i)
         {
             vk::DescriptorSetLayoutCreateInfo dslci{};
             dslci.sType = vk::StructureType::eDescriptorSetLayoutCreateInfo;
+            dslci.pNext = &dslbfci;
+            if (update_after_bind) dslci.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
             dslci.bindingCount = layout_bindings.size();
             dslci.pBindings = layout_bindings.data();
             layouts.push_back(vmc.logical_device.get().createDescriptorSetLayout(dslci));
         }
 
+        // the pool needs to provide the full size of every binding, even if it is only partially bound
         std::vector<vk::DescriptorPoolSize> pool_sizes;
         for (const auto d : descriptors)
         {
             vk::DescriptorPoolSize dps{};
             dps.type = d.dslb.descriptorType;
-            dps.descriptorCount = std::max(d.dbi.begin()->size(), d.dii.begin()->size());
+            dps.descriptorCount = d.dslb.descriptorCount * set_count;
             pool_sizes.push_back(dps);
         }
 
         vk::DescriptorPoolCreateInfo dpci{};
         dpci.sType = vk::StructureType::eDescriptorPoolCreateInfo;
+        if (update_after_bind) dpci.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
         dpci.poolSizeCount = pool_sizes.size();
         dpci.pPoolSizes = pool_sizes.data();
         dpci.maxSets = set_count;
@@ -94,12 +109,31 @@ namespace ve
         dsai.pSetLayouts = layouts.data();
 
         sets = vmc.logical_device.get().allocateDescriptorSets(dsai);
+        update();
+    }
+
+    void DescriptorSetHandler::reset_descriptors()
+    {
+        for (auto& d : descriptors)
+        {
+            for (uint32_t i = 0; i < set_count; ++i)
+            {
+                d.dbi[i].clear();
+                d.dii[i].clear();
+                d.pNext[i] = nullptr;
+            }
+        }
+    }
 
+    void DescriptorSetHandler::update()
+    {
         std::vector<vk::WriteDescriptorSet> wds_s;
         for (uint32_t i = 0; i < set_count; ++i)
         {
             for (uint32_t j = 0; j < descriptors.size(); ++j)
             {
+                // partially bound bindings might not have any descriptor
+                if (descriptors[j].dii[i].empty() && descriptors[j].dbi[i].empty()) continue;
                 vk::WriteDescriptorSet wds{};
                 wds.pNext = descriptors[j].pNext[i];
                 wds.sType = vk::StructureType::eWriteDescriptorSet;
@@ -2,7 +2,7 @@
 
 namespace ve
 {
-    Histogram::Histogram(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, frames_in_flight)
+    Histogram::Histogram(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, display_image_count)
     {}
 
     void Histogram::setup_storage(AppState& app_state)
@@ -25,13 +25,19 @@ namespace ve
         dsh.destruct();
     }
 
-    void Histogram::compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image)
+    void Histogram::compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx)
     {
         storage.get_buffer(histogram_buffer).obtain_all_data(app_state.histogram);
         storage.get_buffer(histogram_buffer).update_data_bytes(0, app_state.histogram.size() * sizeof(uint32_t));
+        // the image was just resolved by the same submission
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
         cb.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
-        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[read_only_image], {});
-        cb.dispatch((app_state.render_extent.width + 31) / 32, (app_state.render_extent.height + 31) / 32, 1);
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[image_idx], {});
+        // the image was resolved at the current trace extent, the pixels outside of it are left over from earlier traces
+        const std::array<uint32_t, 2> trace_extent{app_state.trace_extent.width, app_state.trace_extent.height};
+        cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(trace_extent), trace_extent.data());
+        cb.dispatch((app_state.trace_extent.width + 31) / 32, (app_state.trace_extent.height + 31) / 32, 1);
     }
 
     void Histogram::create_pipeline(uint32_t bin_count)
@@ -41,14 +47,14 @@ namespace ve
         std::array<uint32_t, 1> histogram_entries_data{bin_count};
         vk::SpecializationInfo histogram_spec_info(histogram_entries.size(), histogram_entries.data(), sizeof(uint32_t) * histogram_entries_data.size(), histogram_entries_data.data());
         ShaderInfo histogram_shader_info = ShaderInfo{"histogram.comp", vk::ShaderStageFlagBits::eFragment, histogram_spec_info};
-        pipeline.construct(dsh.get_layouts()[0], histogram_shader_info, 0);
+        pipeline.construct(dsh.get_layouts()[0], histogram_shader_info, 2 * sizeof(uint32_t));
     }
 
     void Histogram::create_descriptor_set()
     {
         dsh.add_binding(0, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
-        for (uint32_t i = 0; i < frames_in_flight; ++i)
+        for (uint32_t i = 0; i < display_image_count; ++i)
         {
             dsh.add_descriptor(i, 0, storage.get_image_by_name("path_trace_image_" + std::to_string(i)));
             dsh.add_descriptor(i, 1, storage.get_buffer(histogram_buffer));
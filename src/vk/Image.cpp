@@ -1,5 +1,6 @@
 #include "vk/Image.hpp"
 
+#include <cstring>
 #include <fstream>
 #include <filesystem>
 #include <stb/stb_image.h>
@@ -135,33 +136,35 @@ namespace ve
         cb.pipelineBarrier(src_stage_flags, dst_stage_flags, {}, nullptr, nullptr, imb);
     }
 
-    void copy_buffer_to_image(VulkanCommandContext& vcc, const Buffer& buffer, vk::Extent3D extent, vk::Image image, uint32_t layer_count, uint32_t pixel_byte_size)
+    void copy_data_to_image(VulkanCommandContext& vcc, const unsigned char* data, vk::Extent3D extent, vk::Image image, uint32_t layer_count, uint32_t pixel_byte_size)
     {
-        vk::CommandBuffer& cb = vcc.get_one_time_transfer_buffer();
-        std::vector<vk::BufferImageCopy> copy_regions;
+        // the image is uploaded in bands of rows that fit into the staging chunks
+        const vk::DeviceSize row_byte_size = extent.width * pixel_byte_size;
+        const uint32_t rows_per_copy = std::max<vk::DeviceSize>(1, VulkanCommandContext::staging_chunk_size / row_byte_size);
         for (uint32_t i = 0; i < layer_count; ++i)
         {
-            vk::BufferImageCopy copy_region{};
-            copy_region.bufferOffset = i * extent.width * extent.height * pixel_byte_size;
-            copy_region.bufferRowLength = 0;
-            copy_region.bufferImageHeight = 0;
-            copy_region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-            copy_region.imageSubresource.mipLevel = 0;
-            copy_region.imageSubresource.baseArrayLayer = i;
-            copy_region.imageSubresource.layerCount = 1;
-            copy_region.imageOffset = vk::Offset3D{0, 0, 0};
-            copy_region.imageExtent = extent;
-            copy_regions.push_back(copy_region);
+            for (uint32_t row = 0; row < extent.height; row += rows_per_copy)
+            {
+                const uint32_t row_count = std::min(rows_per_copy, extent.height - row);
+                VulkanCommandContext::StagingAllocation staging = vcc.allocate_staging(row_count * row_byte_size);
+                std::memcpy(staging.data, data + (i * extent.height + row) * row_byte_size, row_count * row_byte_size);
+                vk::BufferImageCopy copy_region{};
+                copy_region.bufferOffset = staging.offset;
+                copy_region.bufferRowLength = 0;
+                copy_region.bufferImageHeight = 0;
+                copy_region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+                copy_region.imageSubresource.mipLevel = 0;
+                copy_region.imageSubresource.baseArrayLayer = i;
+                copy_region.imageSubresource.layerCount = 1;
+                copy_region.imageOffset = vk::Offset3D{0, int32_t(row), 0};
+                copy_region.imageExtent = vk::Extent3D(extent.width, row_count, 1);
+                vcc.get_upload_buffer().copyBufferToImage(staging.buffer, image, vk::ImageLayout::eTransferDstOptimal, copy_region);
+            }
         }
-
-        cb.copyBufferToImage(buffer.get(), image, vk::ImageLayout::eTransferDstOptimal, copy_regions);
-        vcc.submit_transfer(cb, true);
     }
 
     void Image::create_image_from_data(const unsigned char* data, VulkanCommandContext& vcc, const std::vector<uint32_t>& queue_family_indices, uint32_t base_mip_map_lvl, vk::ImageUsageFlags usage_flags, vk::ImageViewType image_view_type)
     {
-        Buffer buffer(vmc, vcc, data, byte_size, vk::BufferUsageFlagBits::eTransferSrc, false, vmc.queue_family_indices.transfer);
-
         vk::FormatProperties format_properties = vmc.physical_device.get().getFormatProperties(format);
         if (!(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear))
         {
@@ -169,12 +172,10 @@ namespace ve
             base_mip_map_lvl = 0;
         }
 
-        auto move_buffer_to_image = [&](vk::Image image, uint32_t mip_levels) -> void {
-            // copy image data to tmp_image
-            vk::CommandBuffer& cb = vcc.get_one_time_transfer_buffer();
-            perform_image_layout_transition(cb, image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, vk::AccessFlagBits::eTransferWrite, 0, mip_levels, layer_count);
-            vcc.submit_transfer(cb, true);
-            copy_buffer_to_image(vcc, buffer, vk::Extent3D(w, h, 1), image, layer_count, c);
+        auto upload_to_image = [&](vk::Image image, uint32_t mip_levels) -> void {
+            // copy image data to tmp_image, transition and copy are part of the pending uploads that the following graphics submission waits for
+            perform_image_layout_transition(vcc.get_upload_buffer(), image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, vk::AccessFlagBits::eTransferWrite, 0, mip_levels, layer_count);
+            copy_data_to_image(vcc, data, vk::Extent3D(w, h, 1), image, layer_count, c);
         };
 
         // check if image should start at base_mip_map_lvl to save some storage
@@ -182,7 +183,7 @@ namespace ve
         if (base_mip_map_lvl > 0)
         {
             auto [tmp_image, tmp_alloc] = create_image({vmc.queue_family_indices.graphics, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc, vk::SampleCountFlagBits::e1, false, format, vk::Extent3D(w, h, 1), layer_count, vmc.va);
-            move_buffer_to_image(tmp_image, 1);
+            upload_to_image(tmp_image, 1);
 
             vk::Offset3D tmp_image_offset(w, h, 1);
             mip_levels -= base_mip_map_lvl;
@@ -190,28 +191,31 @@ namespace ve
             h = std::max(1.0, h / (std::pow(2, base_mip_map_lvl)));
             byte_size = w * h * 4;
 
-            // create image with reduced resolution by blitting
-            vk::CommandBuffer& cb = vcc.get_one_time_graphics_buffer();
+            // create image with reduced resolution by blitting, tmp_image is kept until the batch finished
+            vk::CommandBuffer& cb = vcc.get_graphics_batch_buffer();
             perform_image_layout_transition(cb, tmp_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead, 0, 1, layer_count);
             std::tie(image, vmaa) = create_image(queue_family_indices, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | usage_flags, vk::SampleCountFlagBits::e1, true, format, vk::Extent3D(w, h, 1), layer_count, vmc.va);
             perform_image_layout_transition(cb, image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, vk::AccessFlagBits::eTransferWrite, 0, mip_levels, layer_count);
             blit_image(cb, tmp_image, 0, tmp_image_offset, image, 0, {w, h, 1}, layer_count);
-            vcc.submit_graphics(cb, true);
-
-            vmaDestroyImage(vmc.va, VkImage(tmp_image), tmp_alloc);
+            vcc.destroy_after_graphics_batch(tmp_image, tmp_alloc);
         }
         else
         {
-            // layout of image is transitioned in move_buffer_to_image
+            // layout of image is transitioned in upload_to_image
             std::tie(image, vmaa) = create_image(queue_family_indices, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | usage_flags, vk::SampleCountFlagBits::e1, true, format, vk::Extent3D(w, h, 1), layer_count, vmc.va);
-            move_buffer_to_image(image, mip_levels);
+            upload_to_image(image, mip_levels);
         }
-        buffer.destruct();
         // set current layout of this image
         layout = vk::ImageLayout::eTransferDstOptimal;
+        // the graphics work is part of the graphics batch of vcc, the creator of the images flushes it
         if (usage_flags & vk::ImageUsageFlagBits::eSampled)
         {
-            mip_levels > 1 ? generate_mipmaps(vcc) : transition_image_layout(vcc, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+            if (mip_levels > 1) generate_mipmaps(vcc);
+            else
+            {
+                perform_image_layout_transition(vcc.get_graphics_batch_buffer(), image, layout, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead, 0, mip_levels, layer_count);
+                layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+            }
         }
         create_image_view(vk::ImageAspectFlagBits::eColor, image_view_type);
         create_sampler();
@@ -278,21 +282,8 @@ namespace ve
         layout = new_layout;
     }
 
-    void Image::save_to_file(VulkanCommandContext& vcc)
+    void save_png(const std::vector<unsigned char>& data, uint32_t width, uint32_t height)
     {
-        vk::ImageLayout old_layout = layout;
-        vk::CommandBuffer& cb = vcc.get_one_time_graphics_buffer();
-        auto [dst_image, tmp_vmaa] = create_image(std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc, vk::SampleCountFlagBits::e1, false, format, vk::Extent3D(w, h, 1), layer_count, vmc.va, true);
-
-        perform_image_layout_transition(cb, dst_image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eNone, vk::AccessFlagBits::eTransferWrite, 0, 1, 1);
-        perform_image_layout_transition(cb, image, old_layout, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eMemoryRead ,vk::AccessFlagBits::eTransferRead, 0, 1, 1);
-
-        copy_image(cb, image, dst_image, w, h, 1);
-
-        perform_image_layout_transition(cb, dst_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead, 0, 1, 1);
-        perform_image_layout_transition(cb, image, vk::ImageLayout::eTransferSrcOptimal, old_layout, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eMemoryRead, 0, 1, 1);
-        vcc.submit_graphics(cb, true);
-
         // create target directory if needed
         std::string filename("../images/");
         std::filesystem::path images_path(filename);
@@ -311,6 +302,37 @@ namespace ve
             filename.append(time);
         }
         filename.append(".png");
+        stbi_write_png(filename.c_str(), width, height, 4, data.data(), width * 4);
+    }
+
+    void Image::save_to_file(VulkanCommandContext& vcc)
+    {
+        save_png(obtain_data(vcc), w, h);
+    }
+
+    void Image::save_to_file(VulkanCommandContext& vcc, vk::Extent2D region)
+    {
+        region = vk::Extent2D(std::min<uint32_t>(region.width, w), std::min<uint32_t>(region.height, h));
+        const std::vector<unsigned char> data = obtain_data(vcc);
+        std::vector<unsigned char> region_data(region.width * region.height * 4);
+        for (uint32_t y = 0; y < region.height; ++y) std::memcpy(region_data.data() + y * region.width * 4, data.data() + y * w * 4, region.width * 4);
+        save_png(region_data, region.width, region.height);
+    }
+
+    std::vector<unsigned char> Image::obtain_data(VulkanCommandContext& vcc)
+    {
+        vk::ImageLayout old_layout = layout;
+        vk::CommandBuffer& cb = vcc.get_one_time_graphics_buffer();
+        auto [dst_image, tmp_vmaa] = create_image(std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc, vk::SampleCountFlagBits::e1, false, format, vk::Extent3D(w, h, 1), layer_count, vmc.va, true);
+
+        perform_image_layout_transition(cb, dst_image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eNone, vk::AccessFlagBits::eTransferWrite, 0, 1, 1);
+        perform_image_layout_transition(cb, image, old_layout, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eMemoryRead ,vk::AccessFlagBits::eTransferRead, 0, 1, 1);
+
+        copy_image(cb, image, dst_image, w, h, 1);
+
+        perform_image_layout_transition(cb, dst_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead, 0, 1, 1);
+        perform_image_layout_transition(cb, image, vk::ImageLayout::eTransferSrcOptimal, old_layout, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eMemoryRead, 0, 1, 1);
+        vcc.submit_graphics(cb, true);
 
         // get resource layout of image to read it correctly
         vk::ImageSubresource sub_resource{vk::ImageAspectFlagBits::eColor, 0, 0};
@@ -324,7 +346,7 @@ namespace ve
         std::vector<vk::Format> bgr_formats = {vk::Format::eB8G8R8A8Srgb, vk::Format::eB8G8R8A8Unorm, vk::Format::eB8G8R8A8Snorm};
         bool color_swizzle = (std::find(bgr_formats.begin(), bgr_formats.end(), format) != bgr_formats.end());
 
-        std::vector<char> image_data(w * h * c);
+        std::vector<unsigned char> image_data(w * h * c);
         for (uint32_t y = 0; y < h; ++y)
         {
             char* row = data;
@@ -349,9 +371,9 @@ namespace ve
             data += sub_resource_layout.rowPitch;
         }
 
-        stbi_write_png(filename.c_str(), w, h, c, (void**)image_data.data(), w * c);
         vmaUnmapMemory(vmc.va, tmp_vmaa);
         vmaDestroyImage(vmc.va, VkImage(dst_image), tmp_vmaa);
+        return image_data;
     }
 
     vk::DeviceSize Image::get_byte_size() const
@@ -386,7 +408,8 @@ namespace ve
 
     void Image::generate_mipmaps(VulkanCommandContext& vcc)
     {
-        vk::CommandBuffer& cb = vcc.get_one_time_graphics_buffer();
+        // recorded into the graphics batch to generate the mip maps of many images with one submission
+        vk::CommandBuffer& cb = vcc.get_graphics_batch_buffer();
         vk::ImageMemoryBarrier imb{};
         imb.sType = vk::StructureType::eImageMemoryBarrier;
         imb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -427,7 +450,5 @@ namespace ve
         imb.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
         imb.dstAccessMask = vk::AccessFlagBits::eShaderRead;
         cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, nullptr, nullptr, imb);
-
-        vcc.submit_graphics(cb, true);
     }
 } // namespace ve
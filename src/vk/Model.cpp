@@ -1,5 +1,7 @@
 #include "vk/Model.hpp"
 
+#include <cstring>
+#include <limits>
 #include <string>
 
 #define TINYGLTF_IMPLEMENTATION
@@ -12,71 +14,92 @@
 
 namespace ve
 {
-    void Model::apply_transformation(const glm::mat4& transformation)
+    namespace ModelLoader
     {
-        for (auto& v : vertices)
+        // lookup tables of one glb file, every model is loaded with its own context so that models can be loaded concurrently
+        // materials and textures are loaded when they are needed which requires to know if a texture or material is already loaded (-1 = not loaded)
+        // glTF meshes are only expanded once, every further node referencing them reuses the mesh group (-1 = not loaded)
+        struct Context
         {
-            v.pos = transformation * glm::vec4(v.pos, 1.0f);
-            v.normal = glm::transpose(glm::inverse(transformation)) * glm::vec4(v.normal, 0.0f);
-        }
-        for (auto& l : lights)
+            std::vector<int32_t> texture_indices;
+            std::vector<int32_t> material_indices;
+            std::vector<int32_t> mesh_group_indices;
+        };
+
+        template<typename T>
+        float read_component(const unsigned char* data, int component, bool normalized)
         {
-            l.pos = transformation * glm::vec4(l.pos, 1.0f);
-            l.dir = transformation * glm::vec4(l.dir, 0.0f);
+            T value;
+            std::memcpy(&value, data + component * sizeof(T), sizeof(T));
+            if (!normalized) return float(value);
+            // normalized signed integers map to [-1, 1] with both the smallest and second smallest value representing -1
+            if constexpr (std::is_signed_v<T>) return std::max(float(value) / float(std::numeric_limits<T>::max()), -1.0f);
+            else return float(value) / float(std::numeric_limits<T>::max());
         }
-    }
 
-    namespace ModelLoader
-    {
-        // all indices need to be offset by the amount of data that will be stored in front
-        uint32_t total_index_count;
-        uint32_t total_vertex_count;
-        uint32_t total_material_count;
-        uint32_t total_texture_count;
-        // materials and textures are loaded when they are needed which requires to know if a texture or material is already loaded (-1 = not loaded)
-        std::vector<int32_t> texture_indices;
-        std::vector<int32_t> material_indices;
-
-        void reset()
+        // read element i of an accessor as float vector, integer components are supported as used by KHR_mesh_quantization
+        // missing components are 0, except for the fourth component which is 1 (e.g. for rgb vertex colors)
+        template<int N>
+        glm::vec<N, float> read_accessor(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t i)
         {
-            total_index_count = 0;
-            total_vertex_count = 0;
-            total_material_count = 0;
-            total_texture_count = 0;
-            texture_indices.clear();
-            material_indices.clear();
+            const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+            const unsigned char* data = &(model.buffers[view.buffer].data[view.byteOffset + accessor.byteOffset + i * accessor.ByteStride(view)]);
+            glm::vec<N, float> result(0.0f);
+            if constexpr (N == 4) result[3] = 1.0f;
+            for (int c = 0; c < std::min(N, tinygltf::GetNumComponentsInType(accessor.type)); ++c)
+            {
+                switch (accessor.componentType)
+                {
+                    case TINYGLTF_COMPONENT_TYPE_FLOAT:
+                        result[c] = read_component<float>(data, c, false);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_BYTE:
+                        result[c] = read_component<int8_t>(data, c, accessor.normalized);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                        result[c] = read_component<uint8_t>(data, c, accessor.normalized);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_SHORT:
+                        result[c] = read_component<int16_t>(data, c, accessor.normalized);
+                        break;
+                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                        result[c] = read_component<uint16_t>(data, c, accessor.normalized);
+                        break;
+                    default:
+                        VE_THROW("Vertex attribute component type \"{}\" not supported!", accessor.componentType);
+                }
+            }
+            return result;
         }
 
-        void load_material(const VulkanMainContext& vmc, Storage& storage, int mat_idx, const tinygltf::Model& model, Model& model_data)
+        void load_material(Context& ctx, int mat_idx, const tinygltf::Model& model, Model& model_data)
         {
             if (mat_idx < 0) VE_THROW("Trying to load material_idx < 0!");
-            if (material_indices[mat_idx] > -1) return;
+            if (ctx.material_indices[mat_idx] > -1) return;
             const tinygltf::Material& mat = model.materials[mat_idx];
 
             auto get_texture = [&](const std::string& name, uint32_t base_mip_level) -> int32_t {
                 if (mat.values.find(name) == mat.values.end()) return -1;
                 // check if texture is already loaded and if not load it
                 int texture_idx = mat.values.at(name).TextureIndex();
-                if (texture_indices[texture_idx] > -1) return texture_indices[texture_idx];
+                if (ctx.texture_indices[texture_idx] > -1) return ctx.texture_indices[texture_idx];
                 const tinygltf::Texture& tex = model.textures[texture_idx];
-                texture_indices[texture_idx] = total_texture_count;
-                total_texture_count++;
-                model_data.texture_image_indices.push_back(storage.add_named_image("texture_" + std::to_string(texture_indices[texture_idx]), model.images[tex.source].image.data(), model.images[tex.source].width, model.images[tex.source].height, true, base_mip_level, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled));
-                return texture_indices[texture_idx];
+                ctx.texture_indices[texture_idx] = model_data.textures.size();
+                model_data.textures.push_back(TextureData{model.images[tex.source].image, uint32_t(model.images[tex.source].width), uint32_t(model.images[tex.source].height), base_mip_level});
+                return ctx.texture_indices[texture_idx];
             };
 
             auto get_array_layer_texture = [&](const std::string& name, std::vector<std::vector<unsigned char>>& images, vk::Extent2D& dimensions) -> int32_t {
                 if (mat.values.find(name) == mat.values.end()) return -1;
                 // check if texture is already loaded and if not load it
                 int texture_idx = mat.values.at(name).TextureIndex();
-                if (texture_indices[texture_idx] > -1) return texture_indices[texture_idx];
+                if (ctx.texture_indices[texture_idx] > -1) return ctx.texture_indices[texture_idx];
                 const tinygltf::Texture& tex = model.textures[texture_idx];
-                texture_indices[texture_idx] = total_texture_count;
-                total_texture_count++;
+                ctx.texture_indices[texture_idx] = model_data.textures.size();
                 images.push_back(model.images[tex.source].image);
                 dimensions.width = model.images[tex.source].width;
                 dimensions.height = model.images[tex.source].height;
-                return texture_indices[texture_idx];
+                return ctx.texture_indices[texture_idx];
             };
 
             Material material{};
@@ -109,73 +132,39 @@ namespace ve
             {
                 material.transmission = mat.extensions.at("KHR_materials_transmission").Get("transmissionFactor").GetNumberAsDouble();
             }
-            material_indices[mat_idx] = total_material_count;
-            total_material_count++;
+            ctx.material_indices[mat_idx] = model_data.materials.size();
             model_data.materials.push_back(material);
         }
 
-        void process_mesh(const VulkanMainContext& vmc, Storage& storage, const tinygltf::Mesh& mesh, const tinygltf::Model& model, const glm::mat4 matrix, Model& model_data)
+        void process_mesh(Context& ctx, const tinygltf::Mesh& mesh, const tinygltf::Model& model, Model& model_data)
         {
+            // vertices stay in object space of the mesh, the node transformation is applied by the instance
+            std::vector<Mesh>& mesh_group = model_data.mesh_groups.emplace_back();
             for (const tinygltf::Primitive& primitive : mesh.primitives)
             {
                 uint32_t idx_count = model_data.indices.size();
                 uint32_t vertex_count = model_data.vertices.size();
                 // vertices
                 {
-                    const float* pos_buffer = nullptr;
-                    const float* normal_buffer = nullptr;
-                    const float* tex_buffer = nullptr;
-                    const float* color_buffer = nullptr;
-
-                    int pos_stride;
-                    int normal_stride;
-                    int tex_stride;
-                    int color_stride;
-
-                    // load access information
-                    const tinygltf::Accessor& pos_accessor = model.accessors[primitive.attributes.find("POSITION")->second];
-                    const tinygltf::BufferView& pos_view = model.bufferViews[pos_accessor.bufferView];
-                    pos_buffer = reinterpret_cast<const float*>(&(model.buffers[pos_view.buffer].data[pos_accessor.byteOffset + pos_view.byteOffset]));
-                    pos_stride = pos_accessor.ByteStride(pos_view) ? (pos_accessor.ByteStride(pos_view) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC3);
-                    if (primitive.attributes.find("NORMAL") != primitive.attributes.end())
-                    {
-                        const tinygltf::Accessor& normal_accessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-                        const tinygltf::BufferView& normal_view = model.bufferViews[normal_accessor.bufferView];
-                        normal_buffer = reinterpret_cast<const float*>(&(model.buffers[normal_view.buffer].data[normal_accessor.byteOffset + normal_view.byteOffset]));
-                        normal_stride = normal_accessor.ByteStride(normal_view) ? (normal_accessor.ByteStride(normal_view) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC3);
-                    }
-                    if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end())
-                    {
-                        const tinygltf::Accessor& tex_accessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-                        const tinygltf::BufferView& tex_view = model.bufferViews[tex_accessor.bufferView];
-                        tex_buffer = reinterpret_cast<const float*>(&(model.buffers[tex_view.buffer].data[tex_accessor.byteOffset + tex_view.byteOffset]));
-                        tex_stride = tex_accessor.ByteStride(tex_view) ? (tex_accessor.ByteStride(tex_view) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC2);
-                    }
-                    if (primitive.attributes.find("COLOR_0") != primitive.attributes.end())
-                    {
-                        const tinygltf::Accessor& color_accessor = model.accessors[primitive.attributes.find("COLOR_0")->second];
-                        const tinygltf::BufferView& color_view = model.bufferViews[color_accessor.bufferView];
-                        color_buffer = reinterpret_cast<const float*>(&(model.buffers[color_view.buffer].data[color_accessor.byteOffset + color_view.byteOffset]));
-                        color_stride = color_accessor.ByteStride(color_view) ? (color_accessor.ByteStride(color_view) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC3);
-                    }
+                    auto find_accessor = [&](const std::string& name) -> const tinygltf::Accessor* {
+                        auto attribute = primitive.attributes.find(name);
+                        return attribute != primitive.attributes.end() ? &model.accessors[attribute->second] : nullptr;
+                    };
+                    const tinygltf::Accessor* pos_accessor = find_accessor("POSITION");
+                    const tinygltf::Accessor* normal_accessor = find_accessor("NORMAL");
+                    const tinygltf::Accessor* tex_accessor = find_accessor("TEXCOORD_0");
+                    const tinygltf::Accessor* color_accessor = find_accessor("COLOR_0");
+                    VE_ASSERT(pos_accessor, "No positions in this model!");
+                    VE_ASSERT(normal_accessor, "No normals in this model!");
 
                     // access data and load vertices
-                    for (size_t i = 0; i < pos_accessor.count; ++i)
+                    for (size_t i = 0; i < pos_accessor->count; ++i)
                     {
                         Vertex vertex;
-                        glm::vec4 tmp_pos = matrix * glm::vec4(glm::make_vec3(&pos_buffer[i * pos_stride]), 1.0f);
-                        vertex.pos = glm::vec3(tmp_pos.x / tmp_pos.w, tmp_pos.y / tmp_pos.w, tmp_pos.z / tmp_pos.w);
-                        VE_ASSERT(normal_buffer, "No normals in this model!");
-                        vertex.normal = glm::normalize(glm::make_vec3(&normal_buffer[i * normal_stride]));
-                        if (color_buffer)
-                        {
-                            vertex.color = glm::make_vec4(&color_buffer[i * color_stride]);
-                        }
-                        else
-                        {
-                            vertex.color = glm::vec4(1.0f);
-                        }
-                        vertex.tex = tex_buffer ? glm::make_vec2(&tex_buffer[i * tex_stride]) : glm::vec2(-1.0f);
+                        vertex.pos = read_accessor<3>(model, *pos_accessor, i);
+                        vertex.normal = glm::normalize(read_accessor<3>(model, *normal_accessor, i));
+                        vertex.color = color_accessor ? read_accessor<4>(model, *color_accessor, i) : glm::vec4(1.0f);
+                        vertex.tex = tex_accessor ? read_accessor<2>(model, *tex_accessor, i) : glm::vec2(-1.0f);
                         model_data.vertices.push_back(vertex);
                     }
                 }
@@ -187,7 +176,7 @@ namespace ve
                 auto add_indices([&](const auto* buf) -> void {
                     for (size_t i = 0; i < accessor.count; ++i)
                     {
-                        model_data.indices.push_back(buf[i] + total_vertex_count + vertex_count);
+                        model_data.indices.push_back(buf[i] + vertex_count);
                     }
                 });
                 switch (accessor.componentType)
@@ -206,17 +195,20 @@ namespace ve
                 }
                 if (primitive.material > -1)
                 {
-                    load_material(vmc, storage, primitive.material, model, model_data);
-                    model_data.meshes.push_back(Mesh(material_indices[primitive.material], total_index_count + idx_count, model_data.indices.size() - idx_count, mesh.name));
+                    load_material(ctx, primitive.material, model, model_data);
+                    mesh_group.push_back(Mesh(ctx.material_indices[primitive.material], idx_count, model_data.indices.size() - idx_count, mesh.name));
                 }
                 else
                 {
-                    model_data.meshes.push_back(Mesh(-1, total_index_count + idx_count, model_data.indices.size() - idx_count, mesh.name));
+                    mesh_group.push_back(Mesh(-1, idx_count, model_data.indices.size() - idx_count, mesh.name));
                 }
+                mesh_group.back().vertex_offset = vertex_count;
+                mesh_group.back().vertex_count = model_data.vertices.size() - vertex_count;
+                mesh_group.back().vertex_colors = primitive.attributes.contains("COLOR_0");
             }
         }
 
-        void process_node(const VulkanMainContext& vmc, Storage& storage, const tinygltf::Node& node, const tinygltf::Model& model, const glm::mat4 trans, Model& model_data)
+        void process_node(Context& ctx, const tinygltf::Node& node, const tinygltf::Model& model, const glm::mat4 trans, Model& model_data)
         {
             glm::vec3 translation = (node.translation.size() == 3) ? glm::make_vec3(node.translation.data()) : glm::dvec3(0.0f);
             glm::quat q = (node.rotation.size() == 4) ? glm::make_quat(node.rotation.data()) : glm::qua<double>();
@@ -225,15 +217,28 @@ namespace ve
             matrix = trans * glm::translate(glm::mat4(1.0f), translation) * glm::mat4(q) * glm::scale(glm::mat4(1.0f), scale) * matrix;
             for (auto& child_idx : node.children)
             {
-                process_node(vmc, storage, model.nodes[child_idx], model, matrix, model_data);
+                process_node(ctx, model.nodes[child_idx], model, matrix, model_data);
+            }
+            if (node.mesh > -1)
+            {
+                if (ctx.mesh_group_indices[node.mesh] < 0)
+                {
+                    ctx.mesh_group_indices[node.mesh] = model_data.mesh_groups.size();
+                    process_mesh(ctx, model.meshes[node.mesh], model, model_data);
+                }
+                model_data.mesh_instances.push_back(MeshInstance{uint32_t(ctx.mesh_group_indices[node.mesh]), matrix});
             }
-            if (node.mesh > -1) (process_mesh(vmc, storage, model.meshes[node.mesh], model, matrix, model_data));
             if (node.extensions.contains("KHR_lights_punctual"))
             {
                 const auto& lights = node.extensions.at("KHR_lights_punctual");
                 int32_t light_idx = lights.Get("light").GetNumberAsInt();
                 const auto& light = model.lights[light_idx];
-                
+                if (light.type == "directional")
+                {
+                    spdlog::warn("Directional lights are not supported, skipping light \"{}\"", light.name);
+                    return;
+                }
+
                 Light l;
                 l.dir = glm::vec3(glm::normalize(matrix * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f)));
                 glm::vec4 pos = matrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
@@ -249,22 +254,26 @@ namespace ve
 
                 l.intensity = light.intensity * 20.0;
 
-                l.innerConeAngle = std::cos(light.spot.innerConeAngle / 1.0);
-                l.outerConeAngle = std::cos(light.spot.outerConeAngle / 1.0);
+                // cosines of the cone angles, a point light is stored as spot light with cone angles of pi
+                l.innerConeAngle = light.type == "spot" ? std::cos(light.spot.innerConeAngle / 1.0) : -1.0f;
+                l.outerConeAngle = light.type == "spot" ? std::cos(light.spot.outerConeAngle / 1.0) : -1.0f;
                 model_data.lights.push_back(l);
             }
         }
 
-        int load_json_material(const VulkanMainContext& vmc, Storage& storage, const nlohmann::json& model, Model& model_data)
+        int32_t load_json_material(const nlohmann::json& model, Model& model_data)
         {
             auto material_json = model.at("material");
             Material m;
             if (material_json.contains("base_texture"))
             {
-                m.base_texture = total_texture_count;
-                total_texture_count++;
+                m.base_texture = model_data.textures.size();
                 std::string filename(std::string("../assets/textures/") + std::string(material_json.value("base_texture", "")));
-                model_data.texture_image_indices.push_back(storage.add_named_image("texture_" + std::to_string(m.base_texture), filename, true, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled));
+                int w, h, c;
+                stbi_uc* pixels = stbi_load(filename.c_str(), &w, &h, &c, STBI_rgb_alpha);
+                if (!pixels) VE_THROW("Failed to load texture \"{}\"", filename);
+                model_data.textures.push_back(TextureData{std::vector<unsigned char>(pixels, pixels + w * h * 4), uint32_t(w), uint32_t(h), 0});
+                stbi_image_free(pixels);
             }
             if (material_json.contains("emission")) m.emission = glm::vec4(material_json.at("emission")[0], material_json.at("emission")[1], material_json.at("emission")[2], material_json.at("emission")[3]);
             if (material_json.contains("emission_strength")) m.emission_strength = material_json.at("emission_strength");
@@ -279,11 +288,10 @@ namespace ve
                 m.C = glm::vec3(s_c.at("C")[0], s_c.at("C")[1], s_c.at("C")[2]);
             }
             model_data.materials.push_back(m);
-            total_material_count++;
-            return total_material_count - 1;
+            return model_data.materials.size() - 1;
         }
 
-        Model load(const VulkanMainContext& vmc, Storage& storage, const nlohmann::json& json_model)
+        Model load(const nlohmann::json& json_model)
         {
             Model model_data{};
             std::string path = std::string("../assets/models/") + std::string(json_model.value("file", ""));
@@ -296,33 +304,34 @@ namespace ve
             if (!warn.empty()) spdlog::warn(warn);
             if (!err.empty()) VE_THROW(err);
 
-            texture_indices.resize(model.textures.size(), -1);
+            Context ctx;
+            ctx.texture_indices.resize(model.textures.size(), -1);
+            ctx.mesh_group_indices.resize(model.meshes.size(), -1);
             int mat_idx = -1;
             if (json_model.contains("material"))
             {
                 // override all material indices with the material from the json file
-                mat_idx = load_json_material(vmc, storage, json_model, model_data);
+                mat_idx = load_json_material(json_model, model_data);
             }
-            material_indices.resize(model.materials.size(), mat_idx);
+            ctx.material_indices.resize(model.materials.size(), mat_idx);
 
             const tinygltf::Scene& scene = model.scenes[model.defaultScene > -1 ? model.defaultScene : 0];
             // traverse scene nodes
             for (auto& node_idx : scene.nodes)
             {
-                process_node(vmc, storage, model.nodes[node_idx], model, glm::mat4(1.0f), model_data);
+                process_node(ctx, model.nodes[node_idx], model, glm::mat4(1.0f), model_data);
             }
-            total_vertex_count += model_data.vertices.size();
-            total_index_count += model_data.indices.size();
-            texture_indices.clear();
-            material_indices.clear();
             if (model.materials.size() == 0)
             {
-                for (auto& m : model_data.meshes) m.material_idx = mat_idx;
+                for (auto& mesh_group : model_data.mesh_groups)
+                {
+                    for (auto& m : mesh_group) m.material_idx = mat_idx;
+                }
             }
             return model_data;
         }
 
-        Model load_custom(const VulkanMainContext& vmc, Storage& storage, const nlohmann::json& model)
+        Model load_custom(const nlohmann::json& model)
         {
             Model model_data{};
             // load custom directly in json defined models
@@ -337,19 +346,19 @@ namespace ve
             }
             for (auto& i : model.at("indices"))
             {
-                model_data.indices.push_back(uint32_t(i) + total_vertex_count);
+                model_data.indices.push_back(uint32_t(i));
             }
             if (model.contains("material"))
             {
-                model_data.meshes.push_back(Mesh(load_json_material(vmc, storage, model, model_data), total_index_count, model_data.indices.size(), "custom_model"));
+                model_data.mesh_groups.push_back({Mesh(load_json_material(model, model_data), 0, model_data.indices.size(), "custom_model")});
             }
             else
             {
-                model_data.meshes.push_back(Mesh(-1, total_index_count, model_data.indices.size(), "custom_model"));
+                model_data.mesh_groups.push_back({Mesh(-1, 0, model_data.indices.size(), "custom_model")});
             }
-            total_vertex_count += model_data.vertices.size();
-            total_index_count += model_data.indices.size();
-            material_indices.clear();
+            model_data.mesh_groups.back().back().vertex_count = model_data.vertices.size();
+            model_data.mesh_groups.back().back().vertex_colors = true;
+            model_data.mesh_instances.push_back(MeshInstance{0, glm::mat4(1.0f)});
             return model_data;
         }
 
@@ -1,27 +1,32 @@
 #include "vk/PathTraceBuilder.hpp"
 
+#include <cstring>
+
 namespace ve 
 {
+    // upper limit of the scratch memory used by one batch of blas builds
+    constexpr vk::DeviceSize max_blas_scratch_size = 256 * 1024 * 1024;
+    // number of consecutive tlas refits before the tlas is rebuilt from scratch
+    constexpr uint32_t max_tlas_refits = 64;
+
     PathTraceBuilder::PathTraceBuilder(const VulkanMainContext& vmc, VulkanCommandContext& vcc, Storage& storage) : vmc(vmc), vcc(vcc), storage(storage) {}
 
     void PathTraceBuilder::destruct()
     {
-        vmc.logical_device.get().destroyAccelerationStructureKHR(topLevelAS.handle);
-        storage.destroy_buffer(topLevelAS.buffer);
-        storage.destroy_buffer(topLevelAS.scratch_buffer);
-        storage.destroy_buffer(instances_buffer);
+        destroy_acceleration_structure(topLevelAS);
+        storage.destroy_buffer(tlas_scratch_buffer);
+        for (uint32_t i : instances_buffers) storage.destroy_buffer(i);
+        instances_buffers.clear();
 
-        for (auto& blas : bottomLevelAS)
-        {
-            vmc.logical_device.get().destroyAccelerationStructureKHR(blas.handle);
-            storage.destroy_buffer(blas.buffer);
-            storage.destroy_buffer(blas.scratch_buffer);
-        }
+        for (auto& blas : bottomLevelAS) destroy_acceleration_structure(blas);
         bottomLevelAS.clear();
+        pending_blas.clear();
         instances.clear();
+        instances_mappings.clear();
+        tlas_refit_count = 0;
     }
 
-    uint32_t PathTraceBuilder::add_blas(vk::CommandBuffer& cb, uint32_t vertex_buffer_id, uint32_t index_buffer_id, const std::vector<uint32_t>& index_offsets, const std::vector<uint32_t>& index_counts, vk::DeviceSize vertex_stride) 
+    uint32_t PathTraceBuilder::add_blas(uint32_t vertex_buffer_id, uint32_t index_buffer_id, const std::vector<uint32_t>& index_offsets, const std::vector<uint32_t>& index_counts, vk::DeviceSize vertex_stride) 
     {
         Buffer& vertex_buffer = storage.get_buffer(vertex_buffer_id);
         Buffer& index_buffer = storage.get_buffer(index_buffer_id);
@@ -29,10 +34,7 @@ namespace ve
         vk::DeviceOrHostAddressConstKHR vertex_buffer_device_adress(vertex_buffer.get_device_address());
         vk::DeviceOrHostAddressConstKHR index_buffer_device_adress(index_buffer.get_device_address());
 
-        std::vector<uint32_t> num_triangles;
-        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> asbris;
-        std::vector<vk::AccelerationStructureBuildRangeInfoKHR*> pasbris;
-        std::vector<vk::AccelerationStructureGeometryKHR> asgs;
+        BlasGeometry& geometry = pending_blas.emplace_back();
         for (uint32_t i = 0; i < index_offsets.size(); ++i)
         {
             vk::AccelerationStructureBuildRangeInfoKHR asbri{};
@@ -40,8 +42,7 @@ namespace ve
             asbri.primitiveOffset = sizeof(uint32_t) * index_offsets[i];
             asbri.firstVertex = 0;
             asbri.transformOffset = 0;
-            asbris.push_back(asbri);
-            num_triangles.push_back(asbri.primitiveCount);
+            geometry.asbris.push_back(asbri);
 
             vk::AccelerationStructureGeometryKHR asg{};
             asg.flags = vk::GeometryFlagBitsKHR::eOpaque;
@@ -55,54 +56,140 @@ namespace ve
             asg.geometry.triangles.indexData = index_buffer_device_adress;
             asg.geometry.triangles.transformData.deviceAddress = 0;
             asg.geometry.triangles.transformData.hostAddress = nullptr;
-            asgs.push_back(asg);
+            geometry.asgs.push_back(asg);
         }
-        pasbris.push_back(asbris.data());
+        return bottomLevelAS.size() + pending_blas.size() - 1;
+    }
 
-        vk::AccelerationStructureBuildGeometryInfoKHR asbgi{};
-        asbgi.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-        asbgi.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-        asbgi.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
-        asbgi.geometryCount = asgs.size();
-        asbgi.pGeometries = asgs.data();
+    void PathTraceBuilder::build_blas()
+    {
+        if (pending_blas.empty()) return;
+        const vk::Device& device = vmc.logical_device.get();
+        const vk::DeviceSize scratch_alignment = vmc.physical_device.get().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().minAccelerationStructureScratchOffsetAlignment;
+        auto align = [](vk::DeviceSize size, vk::DeviceSize alignment) -> vk::DeviceSize { return (size + alignment - 1) & ~(alignment - 1); };
+        const uint32_t blas_count = pending_blas.size();
+
+        // builds are split into batches whose scratch memory fits into the budget
+        // all builds of a batch run concurrently on disjoint parts of the scratch buffer, the next batch reuses the scratch buffer
+        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> asbgis(blas_count);
+        std::vector<vk::DeviceSize> scratch_offsets(blas_count);
+        std::vector<AccelerationStructure> uncompacted_blas(blas_count);
+        std::vector<uint32_t> batch_begins = {0};
+        vk::DeviceSize batch_scratch_size = 0;
+        vk::DeviceSize scratch_size = 0;
+        for (uint32_t i = 0; i < blas_count; ++i)
+        {
+            asbgis[i].type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+            asbgis[i].flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+            asbgis[i].mode = vk::BuildAccelerationStructureModeKHR::eBuild;
+            asbgis[i].geometryCount = pending_blas[i].asgs.size();
+            asbgis[i].pGeometries = pending_blas[i].asgs.data();
+
+            std::vector<uint32_t> num_triangles;
+            for (const auto& asbri : pending_blas[i].asbris) num_triangles.push_back(asbri.primitiveCount);
+            vk::AccelerationStructureBuildSizesInfoKHR asbsi = device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, asbgis[i], num_triangles);
+            uncompacted_blas[i] = create_blas(asbsi.accelerationStructureSize);
+            asbgis[i].dstAccelerationStructure = uncompacted_blas[i].handle;
+
+            const vk::DeviceSize aligned_scratch_size = align(asbsi.buildScratchSize, scratch_alignment);
+            if (batch_scratch_size > 0 && batch_scratch_size + aligned_scratch_size > max_blas_scratch_size)
+            {
+                batch_begins.push_back(i);
+                batch_scratch_size = 0;
+            }
+            scratch_offsets[i] = batch_scratch_size;
+            batch_scratch_size += aligned_scratch_size;
+            scratch_size = std::max(scratch_size, batch_scratch_size);
+        }
+        batch_begins.push_back(blas_count);
 
+        // the device address of the buffer is not necessarily aligned as required for scratch memory
+        uint32_t scratch_buffer = storage.add_buffer(scratch_size + scratch_alignment, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        const vk::DeviceAddress scratch_address = align(storage.get_buffer(scratch_buffer).get_device_address(), scratch_alignment);
+
+        vk::QueryPoolCreateInfo qpci{};
+        qpci.queryType = vk::QueryType::eAccelerationStructureCompactedSizeKHR;
+        qpci.queryCount = blas_count;
+        vk::QueryPool query_pool = device.createQueryPool(qpci);
+
+        vk::MemoryBarrier build_barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR | vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+        vk::CommandBuffer& cb = vcc.get_one_time_compute_buffer();
+        cb.resetQueryPool(query_pool, 0, blas_count);
+        for (uint32_t b = 0; b + 1 < batch_begins.size(); ++b)
+        {
+            std::vector<vk::AccelerationStructureBuildRangeInfoKHR*> pasbris;
+            for (uint32_t i = batch_begins[b]; i < batch_begins[b + 1]; ++i)
+            {
+                asbgis[i].scratchData.deviceAddress = scratch_address + scratch_offsets[i];
+                pasbris.push_back(pending_blas[i].asbris.data());
+            }
+            cb.buildAccelerationStructuresKHR(pasbris.size(), &asbgis[batch_begins[b]], pasbris.data());
+            cb.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {build_barrier}, {}, {});
+        }
+        std::vector<vk::AccelerationStructureKHR> handles;
+        for (const auto& blas : uncompacted_blas) handles.push_back(blas.handle);
+        cb.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, query_pool, 0);
+        vcc.submit_compute(cb, true);
+        storage.destroy_buffer(scratch_buffer);
+
+        std::vector<vk::DeviceSize> compacted_sizes = device.getQueryPoolResults<vk::DeviceSize>(query_pool, 0, blas_count, blas_count * sizeof(vk::DeviceSize), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait).value;
+        device.destroyQueryPool(query_pool);
+
+        // copy every blas into an allocation of its compacted size
+        vk::DeviceSize uncompacted_size = 0;
+        vk::DeviceSize compacted_size = 0;
+        vk::CommandBuffer& copy_cb = vcc.get_one_time_compute_buffer();
+        for (uint32_t i = 0; i < blas_count; ++i)
+        {
+            AccelerationStructure blas = create_blas(compacted_sizes[i]);
+            vk::CopyAccelerationStructureInfoKHR casi{};
+            casi.src = uncompacted_blas[i].handle;
+            casi.dst = blas.handle;
+            casi.mode = vk::CopyAccelerationStructureModeKHR::eCompact;
+            copy_cb.copyAccelerationStructureKHR(casi);
+            bottomLevelAS.push_back(blas);
+            uncompacted_size += storage.get_buffer(uncompacted_blas[i].buffer).get_byte_size();
+            compacted_size += compacted_sizes[i];
+        }
+        copy_cb.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {build_barrier}, {}, {});
+        vcc.submit_compute(copy_cb, true);
+        for (auto& blas : uncompacted_blas) destroy_acceleration_structure(blas);
+        pending_blas.clear();
+        spdlog::info("Built {} blas, compacted from {:.2f} MiB to {:.2f} MiB", blas_count, double(uncompacted_size) / (1024.0 * 1024.0), double(compacted_size) / (1024.0 * 1024.0));
+    }
+
+    AccelerationStructure PathTraceBuilder::create_blas(vk::DeviceSize size)
+    {
         AccelerationStructure blas;
-        vk::AccelerationStructureBuildSizesInfoKHR asbsi = vmc.logical_device.get().getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, asbgi, num_triangles);
-        blas.buffer = storage.add_buffer(asbsi.accelerationStructureSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        blas.buffer = storage.add_buffer(size, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
 
         vk::AccelerationStructureCreateInfoKHR asci{};
         asci.sType = vk::StructureType::eAccelerationStructureCreateInfoKHR;
         asci.buffer = storage.get_buffer(blas.buffer).get();
-        asci.size = asbsi.accelerationStructureSize;
+        asci.size = size;
         asci.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
         blas.handle = vmc.logical_device.get().createAccelerationStructureKHR(asci);
 
         vk::AccelerationStructureDeviceAddressInfoKHR asdai{};
         asdai.sType = vk::StructureType::eAccelerationStructureDeviceAddressInfoKHR;
         asdai.accelerationStructure = blas.handle;
-
         blas.deviceAddress = vmc.logical_device.get().getAccelerationStructureAddressKHR(&asdai);
+        return blas;
+    }
 
-        blas.scratch_buffer = storage.add_buffer(asbsi.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute); 
-
-        asbgi.dstAccelerationStructure = blas.handle;
-        asbgi.scratchData.deviceAddress = storage.get_buffer(blas.scratch_buffer).get_device_address();
-        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> asbgis{};
-        asbgis.push_back(asbgi);
-
-        cb.buildAccelerationStructuresKHR(asbgis, pasbris);
-        vk::BufferMemoryBarrier buffer_memory_barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR, vmc.queue_family_indices.compute, vmc.queue_family_indices.compute, storage.get_buffer(blas.buffer).get(), 0, storage.get_buffer(blas.buffer).get_byte_size());
-        cb.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlagBits::eDeviceGroup, {}, {buffer_memory_barrier}, {});
-        
-        bottomLevelAS.push_back(blas);
-        return bottomLevelAS.size() - 1;
+    void PathTraceBuilder::destroy_acceleration_structure(AccelerationStructure& as)
+    {
+        vmc.logical_device.get().destroyAccelerationStructureKHR(as.handle);
+        storage.destroy_buffer(as.buffer);
     }
 
     uint32_t PathTraceBuilder::add_instance(uint32_t blas_idx, const glm::mat4& M, uint32_t custom_index)
     {
         vk::AccelerationStructureInstanceKHR instance;
-        instance.transform = std::array<std::array<float, 4>, 3>({std::array<float, 4>({M[0][0], M[0][1], M[0][2], M[0][3]}), std::array<float, 4>({M[1][0], M[1][1], M[1][2], M[1][3]}), std::array<float, 4>({M[2][0], M[2][1], M[2][2], M[2][3]})});
-        instance.accelerationStructureReference = bottomLevelAS[blas_idx].deviceAddress;
+        // VkTransformMatrixKHR is row-major while glm is column-major
+        instance.transform = std::array<std::array<float, 4>, 3>({std::array<float, 4>({M[0][0], M[1][0], M[2][0], M[3][0]}), std::array<float, 4>({M[0][1], M[1][1], M[2][1], M[3][1]}), std::array<float, 4>({M[0][2], M[1][2], M[2][2], M[3][2]})});
+        // a reference of 0 makes the instance inactive
+        instance.accelerationStructureReference = blas_idx == no_blas ? 0 : bottomLevelAS[blas_idx].deviceAddress;
         instance.instanceCustomIndex = custom_index;
         instance.setFlags(vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable);
         instance.mask = 0xFF;
@@ -117,25 +204,27 @@ namespace ve
 
     void PathTraceBuilder::create_tlas(vk::CommandBuffer& cb)
     {
-        instances_buffer = storage.add_buffer(instances.data(), instances.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, false, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
-        storage.get_buffer(instances_buffer).update_data(instances);
-
-        vk::DeviceOrHostAddressConstKHR instance_data_device_address;
-        instance_data_device_address.deviceAddress = storage.get_buffer(instances_buffer).get_device_address();
+        // the instance buffers stay mapped so that transformation changes can be written directly every frame
+        for (uint32_t i = 0; i < frames_in_flight; ++i)
+        {
+            instances_buffers.push_back(storage.add_buffer(instances.size() * sizeof(vk::AccelerationStructureInstanceKHR), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, false, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute));
+            instances_mappings.push_back(storage.get_buffer(instances_buffers.back()).get_persistent_mapping());
+        }
+        write_instances(0);
 
-        vk::AccelerationStructureGeometryKHR asg;
-        asg.geometryType = vk::GeometryTypeKHR::eInstances;
-        asg.flags = vk::GeometryFlagBitsKHR::eOpaque;
-        asg.geometry.instances.sType = vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
-        asg.geometry.instances.arrayOfPointers = VK_FALSE;
-        asg.geometry.instances.data = instance_data_device_address;
+        tlas_geometry = vk::AccelerationStructureGeometryKHR{};
+        tlas_geometry.geometryType = vk::GeometryTypeKHR::eInstances;
+        tlas_geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+        tlas_geometry.geometry.instances.sType = vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
+        tlas_geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+        tlas_geometry.geometry.instances.data.deviceAddress = storage.get_buffer(instances_buffers[0]).get_device_address();
 
         vk::AccelerationStructureBuildGeometryInfoKHR asbgi;
         asbgi.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-        asbgi.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+        asbgi.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
         asbgi.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
         asbgi.geometryCount = 1;
-        asbgi.pGeometries = &asg;
+        asbgi.pGeometries = &tlas_geometry;
 
         uint32_t primitive_count = instances.size();
 
@@ -160,10 +249,50 @@ namespace ve
         wdsas.pAccelerationStructures = &(topLevelAS.handle);
         storage.get_buffer(topLevelAS.buffer).pNext = &(wdsas);
 
-        topLevelAS.scratch_buffer = storage.add_buffer(asbsi.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute); 
+        // the scratch buffer is kept for all later refits and rebuilds
+        tlas_scratch_buffer = storage.add_buffer(std::max(asbsi.buildScratchSize, asbsi.updateScratchSize), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, true, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute); 
+
+        record_tlas_build(cb, vk::BuildAccelerationStructureModeKHR::eBuild);
+    }
+
+    void PathTraceBuilder::update_tlas(vk::CommandBuffer& cb, uint32_t read_only_image)
+    {
+        write_instances(read_only_image);
+        tlas_geometry.geometry.instances.data.deviceAddress = storage.get_buffer(instances_buffers[read_only_image]).get_device_address();
+        // the tlas is shared by all submissions, the previous one may still trace against it
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {}, {}, {}, {});
+        // every refit keeps the topology of the tlas and only grows its bounding boxes, so the tracing performance degrades with moving instances
+        // a full rebuild after some refits restores the quality
+        if (tlas_refit_count < max_tlas_refits)
+        {
+            tlas_refit_count++;
+            record_tlas_build(cb, vk::BuildAccelerationStructureModeKHR::eUpdate);
+        }
+        else
+        {
+            tlas_refit_count = 0;
+            record_tlas_build(cb, vk::BuildAccelerationStructureModeKHR::eBuild);
+        }
+    }
+
+    void PathTraceBuilder::write_instances(uint32_t read_only_image)
+    {
+        std::memcpy(instances_mappings[read_only_image], instances.data(), instances.size() * sizeof(vk::AccelerationStructureInstanceKHR));
+        storage.get_buffer(instances_buffers[read_only_image]).flush(instances.size() * sizeof(vk::AccelerationStructureInstanceKHR));
+    }
 
+    void PathTraceBuilder::record_tlas_build(vk::CommandBuffer& cb, vk::BuildAccelerationStructureModeKHR mode)
+    {
+        vk::AccelerationStructureBuildGeometryInfoKHR asbgi;
+        asbgi.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+        asbgi.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+        asbgi.mode = mode;
+        asbgi.geometryCount = 1;
+        asbgi.pGeometries = &tlas_geometry;
+        // updates are done in place
+        if (mode == vk::BuildAccelerationStructureModeKHR::eUpdate) asbgi.srcAccelerationStructure = topLevelAS.handle;
         asbgi.dstAccelerationStructure = topLevelAS.handle;
-        asbgi.scratchData.deviceAddress = storage.get_buffer(topLevelAS.scratch_buffer).get_device_address();
+        asbgi.scratchData.deviceAddress = storage.get_buffer(tlas_scratch_buffer).get_device_address();
 
         vk::AccelerationStructureBuildRangeInfoKHR asbri{};
         asbri.primitiveCount = instances.size();
@@ -173,5 +302,8 @@ namespace ve
         std::vector<vk::AccelerationStructureBuildRangeInfoKHR*> asbris = {&asbri};
 
         cb.buildAccelerationStructuresKHR(asbgi, asbris);
+        // make the tlas visible to the ray queries of the following path tracing dispatch
+        vk::MemoryBarrier build_barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eComputeShader, {}, {build_barrier}, {}, {});
     }
 } // namespace ve
@@ -1,24 +1,53 @@
 #include "vk/PathTracer.hpp"
 
+#include <algorithm>
+#include <array>
+#include <optional>
+
+#include "SampleTables.hpp"
+
 namespace ve
 {
-    PathTracer::PathTracer(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, frames_in_flight)
+    // size of the bindless texture array, scenes can use any number of textures up to this
+    constexpr uint32_t max_texture_count = 1024;
+    // must match WAVEFRONT_GROUP_SIZE and MAX_PATH_LENGTH of the shaders
+    constexpr uint32_t wavefront_group_size = 256;
+    constexpr uint32_t max_path_length = 128;
+    // the wavefront mode starts with few bounces and records more once paths reach the last one
+    constexpr uint32_t initial_bounce_cap = 16;
+    // must match ADAPTIVE_TILE_SIZE of the shaders
+    constexpr uint32_t adaptive_tile_size = 32;
+
+    PathTracer::PathTracer(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), adaptive_mask_pipeline(vmc), reproject_pipeline(vmc), wavefront_pipelines(WAVEFRONT_KERNEL_COUNT, Pipeline(vmc)), dsh(vmc, frames_in_flight)
     {}
 
     void PathTracer::setup_storage(AppState& app_state)
     {
         // set up images for path tracing
         std::vector<unsigned char> initial_image(app_state.render_extent.width * app_state.render_extent.height * 4, 0);
-        path_trace_images.push_back(storage.add_named_image("path_trace_image_0", initial_image.data(), app_state.render_extent.width, app_state.render_extent.height, false, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc));
-        path_trace_images.push_back(storage.add_named_image("path_trace_image_1", initial_image.data(), app_state.render_extent.width, app_state.render_extent.height, false, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc));
+        for (uint32_t i = 0; i < display_image_count; ++i) path_trace_images.push_back(storage.add_named_image("path_trace_image_" + std::to_string(i), initial_image.data(), app_state.render_extent.width, app_state.render_extent.height, false, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc));
+
+        // the samples are accumulated in place, the depth buffer is only allocated once the path depth view is used
+        add_accumulation_buffer(app_state);
+
+        // tables of the low discrepancy samplers
+        sample_table_buffers.push_back(storage.add_named_buffer("sobol_matrices", generate_sobol_matrices(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
+        sample_table_buffers.push_back(storage.add_named_buffer("blue_noise", generate_blue_noise(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
 
-        // set up buffers for path tracing
-        std::vector<float> initial_buffer_data(app_state.render_extent.width * app_state.render_extent.height * 4, 0);
-        path_trace_buffers.push_back(storage.add_named_buffer("path_trace_buffer_0", initial_buffer_data, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
-        path_trace_buffers.push_back(storage.add_named_buffer("path_trace_buffer_1", initial_buffer_data, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
-        initial_buffer_data.resize(app_state.render_extent.width * app_state.render_extent.height, 0.0);
-        path_depth_buffers.push_back(storage.add_named_buffer("path_depth_buffer_0", initial_buffer_data, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
-        path_depth_buffers.push_back(storage.add_named_buffer("path_depth_buffer_1", initial_buffer_data, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
+        // buffers of the adaptive sampling, the size of PixelStats is 16 bytes
+        const uint32_t tile_count = ((app_state.render_extent.width + adaptive_tile_size - 1) / adaptive_tile_size) * ((app_state.render_extent.height + adaptive_tile_size - 1) / adaptive_tile_size);
+        adaptive_buffers.push_back(storage.add_named_buffer("pixel_stats", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * 16, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        adaptive_buffers.push_back(storage.add_named_buffer("tile_mask", std::vector<uint32_t>(tile_count, 0), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.compute));
+        // one count per descriptor set, as the submissions of both can be in flight at the same time
+        for (uint32_t i = 0; i < frames_in_flight; ++i) adaptive_buffers.push_back(storage.add_named_buffer("active_tile_count_" + std::to_string(i), std::vector<uint32_t>{0}, vk::BufferUsageFlagBits::eStorageBuffer, false, vmc.queue_family_indices.compute));
+
+        // number of samples accumulated before a submission, written by the host so that recorded command buffers can be submitted again
+        for (uint32_t i = 0; i < frames_in_flight; ++i) sample_index_buffers.push_back(storage.add_named_buffer("sample_index_" + std::to_string(i), std::vector<uint32_t>{0}, vk::BufferUsageFlagBits::eStorageBuffer, false, vmc.queue_family_indices.compute));
+
+        for (uint32_t i = 0; i < frames_in_flight; ++i) bounce_count_buffers.push_back(storage.add_named_buffer("bounce_count_" + std::to_string(i), std::vector<uint32_t>{0}, vk::BufferUsageFlagBits::eStorageBuffer, false, vmc.queue_family_indices.compute));
+
+        // first hit albedo and normal for the denoiser, the size of AOVData is 32 bytes
+        aov_buffer = storage.add_named_buffer("aov_buffer", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * 32, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute);
     }
 
     void PathTracer::construct(VulkanCommandContext& vcc)
@@ -30,97 +59,342 @@ namespace ve
     {
         for (uint32_t i : path_trace_images) storage.destroy_image(i);
         path_trace_images.clear();
-        for (uint32_t i : path_trace_buffers) storage.destroy_buffer(i);
-        path_trace_buffers.clear();
+        storage.destroy_buffer(accumulation_buffer);
         for (uint32_t i : path_depth_buffers) storage.destroy_buffer(i);
         path_depth_buffers.clear();
+        for (uint32_t i : wavefront_buffers) storage.destroy_buffer(i);
+        wavefront_buffers.clear();
+        for (uint32_t i : sample_table_buffers) storage.destroy_buffer(i);
+        sample_table_buffers.clear();
+        for (uint32_t i : adaptive_buffers) storage.destroy_buffer(i);
+        adaptive_buffers.clear();
+        for (uint32_t i : sample_index_buffers) storage.destroy_buffer(i);
+        sample_index_buffers.clear();
+        for (uint32_t i : bounce_count_buffers) storage.destroy_buffer(i);
+        bounce_count_buffers.clear();
+        storage.destroy_buffer(aov_buffer);
+        for (uint32_t i : reprojection_buffers) storage.destroy_buffer(i);
+        reprojection_buffers.clear();
         pipeline.destruct();
+        adaptive_mask_pipeline.destruct();
+        reproject_pipeline.destruct();
+        for (auto& p : wavefront_pipelines) p.destruct();
         dsh.destruct();
     }
 
     void PathTracer::reload_shaders()
     {
         pipeline.destruct();
+        adaptive_mask_pipeline.destruct();
+        reproject_pipeline.destruct();
+        for (auto& p : wavefront_pipelines) p.destruct();
         create_pipeline();
     }
 
-    void PathTracer::set_scene(uint32_t scene_texture_image_count, bool init)
+    void PathTracer::set_scene(uint32_t scene_texture_image_count, uint32_t emissive_triangle_count, uint32_t punctual_light_count, bool init)
     {
+        if (scene_texture_image_count > max_texture_count) VE_THROW("Scene uses {} textures, but at most {} are supported!", scene_texture_image_count, max_texture_count);
         scene_texture_count = scene_texture_image_count;
-        if (!init)
+        ptpc.emissive_triangle_count = emissive_triangle_count;
+        ptpc.punctual_light_count = punctual_light_count;
+        wavefront_bounce_cap = initial_bounce_cap;
+        if (init)
         {
-            dsh.destruct();
-            pipeline.destruct();
+            create_descriptor_set();
+            create_pipeline();
+        }
+        else
+        {
+            dsh.reset_descriptors();
+            add_descriptors();
+            dsh.update();
         }
-        create_descriptor_set();
-        create_pipeline();
     }
 
-    void PathTracer::compute(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image)
+    void PathTracer::prepare_sample(AppState& app_state, uint32_t read_only_image)
     {
         ptpc.attenuation_view = app_state.attenuation_view;
         ptpc.emission_view = app_state.emission_view;
         ptpc.normal_view = app_state.normal_view;
         ptpc.tex_view = app_state.tex_view;
+        // the depth is only accumulated while it is shown, so it starts over when the view is enabled
+        if (app_state.path_depth_view && !ptpc.path_depth_view) app_state.sample_count = 0;
         ptpc.path_depth_view = app_state.path_depth_view;
-        if ((ptpc.attenuation_view | ptpc.emission_view | ptpc.normal_view | ptpc.tex_view) != 0) app_state.sample_count = 0;
-        ptpc.sample_count = app_state.sample_count;
-        cb.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
-        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[read_only_image], {});
-        cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(PathTracerPushConstants), &ptpc);
-        cb.dispatch((app_state.render_extent.width + 31) / 32, (app_state.render_extent.height + 31) / 32, 1);
+        ptpc.sampler = app_state.sampler;
+        const bool debug_view = is_debug_view();
+        if (debug_view) app_state.sample_count = 0;
+        // the debug views show the first interaction of a path and only the megakernel traces several samples per dispatch
+        ptpc.samples_per_pixel = (debug_view || app_state.wavefront) ? 1 : std::max(app_state.samples_per_dispatch, 1u);
+        ptpc.viewport_width = app_state.trace_extent.width;
+        ptpc.viewport_height = app_state.trace_extent.height;
+        ptpc.frame_offset_x = app_state.frame_offset.x;
+        ptpc.frame_offset_y = app_state.frame_offset.y;
+        ptpc.frame_width = app_state.frame_extent.width;
+        ptpc.frame_height = app_state.frame_extent.height;
+        // the debug views always trace all pixels
+        ptpc.adaptive_target_error = debug_view ? 0.0f : app_state.adaptive_target_error;
+        ptpc.adaptive_min_samples = app_state.adaptive_min_samples;
+        // the last submission with this descriptor set has finished, so its buffers can be written by the host
+        storage.get_buffer(sample_index_buffers[read_only_image]).update_data(app_state.sample_count);
+        if (ptpc.adaptive_target_error > 0.0f)
+        {
+            // the count belongs to the mask of the last submission with this descriptor set
+            Buffer& active_tile_count_buffer = storage.get_buffer(adaptive_buffers[2 + read_only_image]);
+            app_state.active_tile_count = active_tile_count_buffer.obtain_first_element<uint32_t>();
+            active_tile_count_buffer.update_data_bytes(0, sizeof(uint32_t));
+        }
+        // paths that reached the last recorded bounce were cut short, so twice the needed bounces are recorded from now on
+        Buffer& bounce_count_buffer = storage.get_buffer(bounce_count_buffers[read_only_image]);
+        wavefront_bounce_cap = std::clamp(2 * bounce_count_buffer.obtain_first_element<uint32_t>(), wavefront_bounce_cap, max_path_length);
+        bounce_count_buffer.update_data_bytes(0, sizeof(uint32_t));
+        if (app_state.reproject_history && app_state.sample_count > 0 && reprojection_buffers.empty())
+        {
+            // the size of ReprojectedPixel in reproject.comp
+            reprojection_buffers.push_back(storage.add_named_buffer("reprojection_buffer", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * 64, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+            // the compute command buffers of previous frames have finished, so the sets are not in use
+            dsh.reset_descriptors();
+            add_descriptors();
+            dsh.update();
+        }
+        if (app_state.wavefront && !debug_view && wavefront_buffers.empty()) setup_wavefront_storage(app_state);
+    }
+
+    void PathTracer::record_sample(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image, uint32_t dispatch_count)
+    {
+        // the previous submission may still be running and accumulates into the same buffers
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, {}, barrier, {}, {});
+        // the history is bound through the descriptor set of this sample, so it is reprojected before anything reads it
+        if (app_state.reproject_history && app_state.sample_count > 0) compute_reprojection(cb, app_state, read_only_image);
+        for (uint32_t i = 0; i < dispatch_count; ++i)
+        {
+            // every dispatch accumulates on top of the previous one of the submission
+            if (i > 0) cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, {}, barrier, {}, {});
+            ptpc.dispatch_sample_offset = i * ptpc.samples_per_pixel;
+            if (ptpc.adaptive_target_error > 0.0f) compute_adaptive_mask(cb, app_state, read_only_image);
+            if (app_state.wavefront && !is_debug_view())
+            {
+                cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, wavefront_pipelines[0].get_layout(), 0, dsh.get_sets()[read_only_image], {});
+                compute_wavefront(cb, app_state);
+                continue;
+            }
+            cb.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
+            cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[read_only_image], {});
+            cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(PathTracerPushConstants), &ptpc);
+            cb.dispatch((app_state.trace_extent.width + 31) / 32, (app_state.trace_extent.height + 31) / 32, 1);
+        }
+        ptpc.dispatch_sample_offset = 0;
+        recorded_bounce_caps[read_only_image] = wavefront_bounce_cap;
+    }
+
+    bool PathTracer::needs_recording(uint32_t read_only_image) const
+    {
+        return recorded_bounce_caps[read_only_image] != wavefront_bounce_cap;
+    }
+
+    bool PathTracer::needs_storage_update(const AppState& app_state) const
+    {
+        const bool debug_view = app_state.attenuation_view || app_state.emission_view || app_state.normal_view || app_state.tex_view;
+        return (app_state.path_depth_view && path_depth_buffers.empty()) || app_state.half_precision_accumulation != (ptpc.half_precision_accumulation != 0) || (app_state.reproject_history && app_state.sample_count > 0 && reprojection_buffers.empty()) || (app_state.wavefront && !debug_view && wavefront_buffers.empty());
+    }
+
+    bool PathTracer::update_accumulation_buffers(AppState& app_state)
+    {
+        const bool add_path_depth_buffer = app_state.path_depth_view && path_depth_buffers.empty();
+        const bool replace_accumulation_buffer = app_state.half_precision_accumulation != (ptpc.half_precision_accumulation != 0);
+        if (!add_path_depth_buffer && !replace_accumulation_buffer) return false;
+        // the compute command buffers of previous frames have finished, so the buffers and sets are not in use
+        if (add_path_depth_buffer) path_depth_buffers.push_back(storage.add_named_buffer("path_depth_buffer", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * sizeof(float), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        if (replace_accumulation_buffer)
+        {
+            storage.destroy_buffer(accumulation_buffer);
+            add_accumulation_buffer(app_state);
+            app_state.sample_count = 0;
+        }
+        dsh.reset_descriptors();
+        add_descriptors();
+        dsh.update();
+        return true;
+    }
+
+    const std::vector<uint32_t>& PathTracer::get_images() const
+    {
+        return path_trace_images;
+    }
+
+    uint32_t PathTracer::get_samples_per_pixel() const
+    {
+        return ptpc.samples_per_pixel;
+    }
+
+    bool PathTracer::is_debug_view() const
+    {
+        return (ptpc.attenuation_view | ptpc.emission_view | ptpc.normal_view | ptpc.tex_view) != 0;
+    }
+
+    void PathTracer::add_accumulation_buffer(const AppState& app_state)
+    {
+        ptpc.half_precision_accumulation = app_state.half_precision_accumulation;
+        // four halfs or four floats per pixel, the first sample of an accumulation overwrites the contents
+        const std::size_t pixel_size = app_state.half_precision_accumulation ? 8 : 16;
+        accumulation_buffer = storage.add_named_buffer("accumulation_buffer", std::size_t(app_state.render_extent.width) * app_state.render_extent.height * pixel_size, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute);
+    }
+
+    void PathTracer::compute_adaptive_mask(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image)
+    {
+        cb.bindPipeline(vk::PipelineBindPoint::eCompute, adaptive_mask_pipeline.get());
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, adaptive_mask_pipeline.get_layout(), 0, dsh.get_sets()[read_only_image], {});
+        cb.pushConstants(adaptive_mask_pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(PathTracerPushConstants), &ptpc);
+        cb.dispatch((app_state.trace_extent.width + adaptive_tile_size - 1) / adaptive_tile_size, (app_state.trace_extent.height + adaptive_tile_size - 1) / adaptive_tile_size, 1);
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+    }
+
+    void PathTracer::compute_reprojection(vk::CommandBuffer& cb, const AppState& app_state, uint32_t read_only_image)
+    {
+        cb.bindPipeline(vk::PipelineBindPoint::eCompute, reproject_pipeline.get());
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, reproject_pipeline.get_layout(), 0, dsh.get_sets()[read_only_image], {});
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        for (ptpc.kernel_pass = 0; ptpc.kernel_pass < 2; ++ptpc.kernel_pass)
+        {
+            cb.pushConstants(reproject_pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(PathTracerPushConstants), &ptpc);
+            cb.dispatch((app_state.trace_extent.width + 31) / 32, (app_state.trace_extent.height + 31) / 32, 1);
+            cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+        }
+        ptpc.kernel_pass = 0;
+    }
+
+    void PathTracer::setup_wavefront_storage(const AppState& app_state)
+    {
+        const std::size_t path_count = app_state.render_extent.width * app_state.render_extent.height;
+        // sizes of PathState, Hit and ShadowRay in wavefront.glsl
+        wavefront_buffers.push_back(storage.add_named_buffer("wavefront_path_states", path_count * 112, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        wavefront_buffers.push_back(storage.add_named_buffer("wavefront_hits", path_count * 24, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        wavefront_buffers.push_back(storage.add_named_buffer("wavefront_ray_queues", path_count * 2 * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        wavefront_buffers.push_back(storage.add_named_buffer("wavefront_shadow_rays", path_count * 48, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.compute));
+        wavefront_buffers.push_back(storage.add_named_buffer("wavefront_counters", std::size_t(48), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, true, vmc.queue_family_indices.compute));
+        // the compute command buffers of previous frames have finished, so the sets are not in use
+        dsh.reset_descriptors();
+        add_descriptors();
+        dsh.update();
+    }
+
+    void PathTracer::compute_wavefront(vk::CommandBuffer& cb, const AppState& app_state)
+    {
+        const vk::Buffer counters = storage.get_buffer(wavefront_buffers[WAVEFRONT_COUNTERS]).get();
+        // offsets of the dispatch arguments in WavefrontCounterBuffer
+        constexpr vk::DeviceSize ray_dispatch_offset = 16;
+        constexpr vk::DeviceSize prepare_dispatch_offset = 32;
+        const vk::PipelineLayout layout = wavefront_pipelines[0].get_layout();
+        // the counters and dispatch arguments are written by one kernel and read by the next one
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead);
+        const vk::PipelineStageFlags src_stages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer;
+        const vk::PipelineStageFlags dst_stages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect;
+        auto dispatch = [&](WavefrontKernel kernel, std::optional<vk::DeviceSize> indirect_offset, uint32_t group_count_x, uint32_t group_count_y) {
+            cb.bindPipeline(vk::PipelineBindPoint::eCompute, wavefront_pipelines[kernel].get());
+            cb.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PathTracerPushConstants), &ptpc);
+            if (indirect_offset) cb.dispatchIndirect(counters, *indirect_offset);
+            else cb.dispatch(group_count_x, group_count_y, 1);
+            cb.pipelineBarrier(src_stages, dst_stages, {}, barrier, {}, {});
+        };
+
+        const uint32_t pixel_groups_x = (app_state.trace_extent.width + 31) / 32;
+        const uint32_t pixel_groups_y = (app_state.trace_extent.height + 31) / 32;
+        ptpc.bounce = 0;
+        cb.fillBuffer(counters, 0, VK_WHOLE_SIZE, 0);
+        cb.pipelineBarrier(src_stages, dst_stages, {}, barrier, {}, {});
+        dispatch(WAVEFRONT_GENERATE, std::nullopt, pixel_groups_x, pixel_groups_y);
+        // the number of active paths is only known on the device, so the bounces needed by previous samples are recorded
+        // every kernel of a bounce is dispatched indirectly, once the queues are empty the remaining bounces dispatch no workgroups at all
+        for (uint32_t bounce = 0; bounce < wavefront_bounce_cap; ++bounce)
+        {
+            ptpc.bounce = bounce;
+            dispatch(WAVEFRONT_PREPARE, prepare_dispatch_offset, 0, 0);
+            dispatch(WAVEFRONT_EXTEND, ray_dispatch_offset, 0, 0);
+            dispatch(WAVEFRONT_SHADE, ray_dispatch_offset, 0, 0);
+            dispatch(WAVEFRONT_CONNECT, ray_dispatch_offset, 0, 0);
+        }
+        dispatch(WAVEFRONT_FINALIZE, std::nullopt, pixel_groups_x, pixel_groups_y);
     }
 
     void PathTracer::create_pipeline()
     {
-        std::array<vk::SpecializationMapEntry, 2> path_tracer_entries;
-        path_tracer_entries[0] = vk::SpecializationMapEntry(0, 0, sizeof(uint32_t));
-        path_tracer_entries[1] = vk::SpecializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t));
-        std::array<uint32_t, 2> path_tracer_entries_data{scene_texture_count, uint32_t(storage.get_buffer_by_name("emissive_mesh_indices").get_element_count())};
-        vk::SpecializationInfo path_tracer_spec_info(path_tracer_entries.size(), path_tracer_entries.data(), sizeof(uint32_t) * path_tracer_entries_data.size(), path_tracer_entries_data.data());
-        ShaderInfo path_tracer_shader_info = ShaderInfo{"path_trace.comp", vk::ShaderStageFlagBits::eFragment, path_tracer_spec_info};
+        ShaderInfo path_tracer_shader_info = ShaderInfo{"path_trace.comp", vk::ShaderStageFlagBits::eCompute};
         pipeline.construct(dsh.get_layouts()[0], path_tracer_shader_info, sizeof(PathTracerPushConstants));
+        reproject_pipeline.construct(dsh.get_layouts()[0], ShaderInfo{"reproject.comp", vk::ShaderStageFlagBits::eCompute}, sizeof(PathTracerPushConstants));
+        adaptive_mask_pipeline.construct(dsh.get_layouts()[0], ShaderInfo{"adaptive_mask.comp", vk::ShaderStageFlagBits::eCompute}, sizeof(PathTracerPushConstants));
+        const std::array<std::string, WAVEFRONT_KERNEL_COUNT> wavefront_shaders{"wf_prepare.comp", "wf_generate.comp", "wf_extend.comp", "wf_shade.comp", "wf_connect.comp", "wf_finalize.comp"};
+        for (uint32_t i = 0; i < WAVEFRONT_KERNEL_COUNT; ++i)
+        {
+            wavefront_pipelines[i].construct(dsh.get_layouts()[0], ShaderInfo{wavefront_shaders[i], vk::ShaderStageFlagBits::eCompute}, sizeof(PathTracerPushConstants));
+        }
     }
 
     void PathTracer::create_descriptor_set()
     {
         dsh.add_binding(0, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(1, vk::DescriptorType::eAccelerationStructureKHR, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(2, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(3, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(5, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(6, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(7, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(6, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1, vk::DescriptorBindingFlagBits::ePartiallyBound);
         dsh.add_binding(10, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(11, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(12, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(13, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(14, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
         dsh.add_binding(15, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
-        dsh.add_binding(16, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, scene_texture_count);
+        dsh.add_binding(16, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, max_texture_count, vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateAfterBind);
         dsh.add_binding(17, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(18, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(19, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(20, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        for (uint32_t i = 0; i < WAVEFRONT_BUFFER_COUNT; ++i) dsh.add_binding(21 + i, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1, vk::DescriptorBindingFlagBits::ePartiallyBound);
+        dsh.add_binding(26, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(27, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(28, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        for (uint32_t i = 0; i < 3; ++i) dsh.add_binding(29 + i, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(32, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(33, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1, vk::DescriptorBindingFlagBits::ePartiallyBound);
+        dsh.add_binding(34, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(35, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(36, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        add_descriptors();
+        dsh.construct();
+    }
+
+    void PathTracer::add_descriptors()
+    {
         for (uint32_t i = 0; i < frames_in_flight; ++i)
         {
-            dsh.add_descriptor(i, 0, storage.get_buffer_by_name("uniform_buffer"));
+            dsh.add_descriptor(i, 0, storage.get_buffer_by_name("uniform_buffer_" + std::to_string(i)));
             dsh.add_descriptor(i, 1, storage.get_buffer_by_name("tlas"));
-            dsh.add_descriptor(i, 2, storage.get_image(path_trace_images[i]));
-            dsh.add_descriptor(i, 3, storage.get_image(path_trace_images[1 - i]));
-            dsh.add_descriptor(i, 4, storage.get_buffer(path_trace_buffers[i]));
-            dsh.add_descriptor(i, 5, storage.get_buffer(path_trace_buffers[1 - i]));
-            dsh.add_descriptor(i, 6, storage.get_buffer(path_depth_buffers[i]));
-            dsh.add_descriptor(i, 7, storage.get_buffer(path_depth_buffers[1 - i]));
-            dsh.add_descriptor(i, 10, storage.get_buffer_by_name("vertices"));
+            // both sets accumulate into the same buffers, submissions are ordered by the barrier at the start of a sample
+            dsh.add_descriptor(i, 4, storage.get_buffer(accumulation_buffer));
+            for (uint32_t j : path_depth_buffers) dsh.add_descriptor(i, 6, storage.get_buffer(j));
+            dsh.add_descriptor(i, 10, storage.get_buffer_by_name("vertex_positions"));
             dsh.add_descriptor(i, 11, storage.get_buffer_by_name("indices"));
             dsh.add_descriptor(i, 12, storage.get_buffer_by_name("materials"));
             dsh.add_descriptor(i, 13, storage.get_buffer_by_name("mesh_render_data"));
             dsh.add_descriptor(i, 14, storage.get_buffer_by_name("model_mrd_indices"));
-            dsh.add_descriptor(i, 15, storage.get_buffer_by_name("emissive_mesh_indices"));
+            dsh.add_descriptor(i, 15, storage.get_buffer_by_name("emissive_triangles"));
             std::vector<Image> images;
             for (uint32_t i = 0; i < scene_texture_count; ++i) images.push_back(storage.get_image_by_name("texture_" + std::to_string(i)));
             dsh.add_descriptor(i, 16, images);
             dsh.add_descriptor(i, 17, storage.get_buffer_by_name("lights"));
+            dsh.add_descriptor(i, 18, storage.get_buffer_by_name("model_transforms_" + std::to_string(i)));
+            dsh.add_descriptor(i, 19, storage.get_buffer_by_name("vertex_attributes"));
+            dsh.add_descriptor(i, 20, storage.get_buffer_by_name("vertex_colors"));
+            for (uint32_t j = 0; j < wavefront_buffers.size(); ++j) dsh.add_descriptor(i, 21 + j, storage.get_buffer(wavefront_buffers[j]));
+            dsh.add_descriptor(i, 26, storage.get_buffer_by_name("light_tree"));
+            dsh.add_descriptor(i, 27, storage.get_buffer(sample_table_buffers[0]));
+            dsh.add_descriptor(i, 28, storage.get_buffer(sample_table_buffers[1]));
+            dsh.add_descriptor(i, 29, storage.get_buffer(adaptive_buffers[0]));
+            dsh.add_descriptor(i, 30, storage.get_buffer(adaptive_buffers[1]));
+            dsh.add_descriptor(i, 31, storage.get_buffer(adaptive_buffers[2 + i]));
+            dsh.add_descriptor(i, 32, storage.get_buffer(aov_buffer));
+            for (uint32_t j : reprojection_buffers) dsh.add_descriptor(i, 33, storage.get_buffer(j));
+            dsh.add_descriptor(i, 34, storage.get_buffer_by_name("previous_uniform_buffer_" + std::to_string(i)));
+            dsh.add_descriptor(i, 35, storage.get_buffer(sample_index_buffers[i]));
+            dsh.add_descriptor(i, 36, storage.get_buffer(bounce_count_buffers[i]));
         }
-        dsh.construct();
     }
 } // namespace ve
@@ -149,7 +149,7 @@ namespace ve
         gpci.basePipelineHandle = VK_NULL_HANDLE;
         gpci.basePipelineIndex = -1;
 
-        vk::ResultValue<vk::Pipeline> pipeline_result_value = vmc.logical_device.get().createGraphicsPipeline(VK_NULL_HANDLE, gpci);
+        vk::ResultValue<vk::Pipeline> pipeline_result_value = vmc.logical_device.get().createGraphicsPipeline(vmc.pipeline_cache, gpci);
         VE_CHECK(pipeline_result_value.result, "Failed to create pipeline!");
         pipeline = pipeline_result_value.value;
 
@@ -185,7 +185,7 @@ namespace ve
         cpci.stage = pssci;
         cpci.layout = pipeline_layout;
 
-        vk::ResultValue<vk::Pipeline> comute_pipeline_result_value = vmc.logical_device.get().createComputePipeline(VK_NULL_HANDLE, cpci);
+        vk::ResultValue<vk::Pipeline> comute_pipeline_result_value = vmc.logical_device.get().createComputePipeline(vmc.pipeline_cache, cpci);
         VE_CHECK(comute_pipeline_result_value.result, "Failed to create compute pipeline!");
         pipeline = comute_pipeline_result_value.value;
 
@@ -2,27 +2,20 @@
 
 namespace ve
 {
-    Renderer::Renderer(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, frames_in_flight)
+    Renderer::Renderer(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, display_image_count)
     {}
 
-    void Renderer::setup_storage(AppState& app_state)
-    {
-        // set up textures that will be rendered
-        std::vector<unsigned char> initial_image(app_state.render_extent.width * app_state.render_extent.height * 4, 0);
-        render_textures.push_back(storage.add_named_image("render_texture_0", initial_image.data(), app_state.render_extent.width, app_state.render_extent.height, false, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc));
-        render_textures.push_back(storage.add_named_image("render_texture_1", initial_image.data(), app_state.render_extent.width, app_state.render_extent.height, false, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc));
-    }
-
-    void Renderer::construct(const RenderPass& render_pass)
+    void Renderer::construct(const RenderPass& render_pass, const std::vector<uint32_t>& path_trace_image_indices)
     {
+        path_trace_images = path_trace_image_indices;
         create_descriptor_set();
         create_pipeline(render_pass);
     }
 
     void Renderer::destruct()
     {
-        for (uint32_t i : render_textures) storage.destroy_image(i);
-        render_textures.clear();
+        // the images are owned by the path tracer
+        path_trace_images.clear();
         pipeline.destruct();
         dsh.destruct();
     }
@@ -32,30 +25,23 @@ namespace ve
         std::vector<ShaderInfo> render_shader_infos(2);
         render_shader_infos[0] = ShaderInfo{"image.vert", vk::ShaderStageFlagBits::eVertex};
         render_shader_infos[1] = ShaderInfo{"image.frag", vk::ShaderStageFlagBits::eFragment};
-        pipeline.construct(render_pass, dsh.get_layouts()[0], render_shader_infos, vk::PolygonMode::eFill, std::vector<vk::VertexInputBindingDescription>(), std::vector<vk::VertexInputAttributeDescription>(), vk::PrimitiveTopology::eTriangleList, {});
+        pipeline.construct(render_pass, dsh.get_layouts()[0], render_shader_infos, vk::PolygonMode::eFill, std::vector<vk::VertexInputBindingDescription>(), std::vector<vk::VertexInputAttributeDescription>(), vk::PrimitiveTopology::eTriangleList, {vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, 0, sizeof(RendererPushConstants))});
     }
 
     void Renderer::create_descriptor_set()
     {
         dsh.add_binding(0, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eFragment);
 
-        for (uint32_t i = 0; i < frames_in_flight; ++i)
+        // the output images of the path tracer are sampled directly in the general layout that the path tracer uses
+        for (uint32_t i = 0; i < display_image_count; ++i)
         {
-            dsh.add_descriptor(i, 0, storage.get_image(render_textures[i]));
+            dsh.add_descriptor(i, 0, storage.get_image(path_trace_images[i]));
         }
         dsh.construct();
     }
 
-    void Renderer::render(vk::CommandBuffer& cb, AppState& app_state, uint32_t read_only_image, const vk::Framebuffer& framebuffer, const vk::RenderPass& render_pass)
+    void Renderer::render(vk::CommandBuffer& cb, AppState& app_state, uint32_t image_idx, vk::Extent2D traced_extent, const vk::Framebuffer& framebuffer, const vk::RenderPass& render_pass)
     {
-        perform_image_layout_transition(cb, storage.get_image(render_textures[app_state.current_frame]).get_image(), vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eNone, vk::AccessFlagBits::eTransferWrite, 0, 1, 1);
-        perform_image_layout_transition(cb, storage.get_image_by_name("path_trace_image_" + std::to_string(read_only_image)).get_image(), vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead, 0, 1, 1);
-
-        copy_image(cb, storage.get_image_by_name("path_trace_image_" + std::to_string(read_only_image)).get_image(), storage.get_image(render_textures[app_state.current_frame]).get_image(), app_state.render_extent.width, app_state.render_extent.height, 1);
-
-        perform_image_layout_transition(cb, storage.get_image(render_textures[app_state.current_frame]).get_image(), vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead, 0, 1, 1);
-        perform_image_layout_transition(cb, storage.get_image_by_name("path_trace_image_" + std::to_string(read_only_image)).get_image(), vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eNone, 0, 1, 1);
-
         vk::RenderPassBeginInfo rpbi{};
         rpbi.sType = vk::StructureType::eRenderPassBeginInfo;
         rpbi.renderPass = render_pass;
@@ -83,8 +69,11 @@ namespace ve
         scissor.extent = app_state.window_extent;
         cb.setScissor(0, scissor);
 
-        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.get_layout(), 0, {dsh.get_sets()[0]}, {});
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.get_layout(), 0, {dsh.get_sets()[image_idx]}, {});
         cb.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.get());
+        rpc.traced_width = traced_extent.width;
+        rpc.traced_height = traced_extent.height;
+        cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eFragment, 0, sizeof(RendererPushConstants), &rpc);
         cb.draw(3, 1, 0, 0);
     }
 } // namespace ve
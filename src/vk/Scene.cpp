@@ -1,13 +1,137 @@
 #include "vk/Scene.hpp"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <limits>
+#include <sstream>
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/ext/quaternion_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/matrix.hpp>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "json.hpp"
+#include "ThreadPool.hpp"
 
 namespace ve
 {
+    namespace
+    {
+        // map unit vector onto the octahedron and unfold it into [-1, 1]^2
+        glm::vec2 encode_octahedral(const glm::vec3& n)
+        {
+            glm::vec2 p = glm::vec2(n) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+            if (n.z < 0.0f)
+            {
+                p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+            }
+            return p;
+        }
+
+        // Vose's alias method, afterwards a triangle is sampled in constant time with two random numbers
+        template<typename T>
+        void build_alias_table(std::vector<T>& entries, const std::vector<float>& weights)
+        {
+            double total_weight = 0.0;
+            for (float w : weights) total_weight += w;
+            // no entry can be picked, the shader rejects entries with a probability of 0
+            if (total_weight <= 0.0) total_weight = 1.0;
+            std::vector<double> scaled_weights(weights.size());
+            std::vector<uint32_t> small;
+            std::vector<uint32_t> large;
+            for (uint32_t i = 0; i < weights.size(); ++i)
+            {
+                entries[i].probability = weights[i] / total_weight;
+                scaled_weights[i] = weights[i] * weights.size() / total_weight;
+                (scaled_weights[i] < 1.0 ? small : large).push_back(i);
+            }
+            while (!small.empty() && !large.empty())
+            {
+                const uint32_t s = small.back();
+                small.pop_back();
+                const uint32_t l = large.back();
+                entries[s].alias_threshold = scaled_weights[s];
+                entries[s].alias = l;
+                scaled_weights[l] += scaled_weights[s] - 1.0;
+                if (scaled_weights[l] < 1.0)
+                {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+            // remaining entries only differ from 1 by rounding errors
+            small.insert(small.end(), large.begin(), large.end());
+            for (uint32_t i : small)
+            {
+                entries[i].alias_threshold = 1.0f;
+                entries[i].alias = i;
+            }
+        }
+
+        float luminance(const glm::vec3& color)
+        {
+            return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+        }
+
+        // bound of the emission directions of a set of lights
+        struct LightCone {
+            glm::vec3 axis;
+            float theta_o;
+            float theta_e;
+        };
+
+        LightCone get_light_cone(const Light& light)
+        {
+            // point lights emit in all directions, spot lights only into their outer cone
+            if (light.outerConeAngle <= -1.0f) return LightCone{glm::vec3(0.0f, 0.0f, 1.0f), glm::pi<float>(), glm::half_pi<float>()};
+            return LightCone{light.dir, 0.0f, std::acos(light.outerConeAngle)};
+        }
+
+        LightCone merge_cones(LightCone a, LightCone b)
+        {
+            if (b.theta_o > a.theta_o) std::swap(a, b);
+            const float theta_d = std::acos(std::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+            const float theta_e = std::max(a.theta_e, b.theta_e);
+            // cone of a already contains cone of b
+            if (std::min(theta_d + b.theta_o, glm::pi<float>()) <= a.theta_o) return LightCone{a.axis, a.theta_o, theta_e};
+            const float theta_o = (a.theta_o + theta_d + b.theta_o) / 2.0f;
+            if (theta_o >= glm::pi<float>()) return LightCone{a.axis, glm::pi<float>(), theta_e};
+            // rotate the axis of a towards the axis of b
+            const glm::vec3 rotation_axis = glm::cross(a.axis, b.axis);
+            if (glm::length(rotation_axis) < 1e-6f) return LightCone{a.axis, theta_o, theta_e};
+            return LightCone{glm::normalize(glm::angleAxis(theta_o - a.theta_o, glm::normalize(rotation_axis)) * a.axis), theta_o, theta_e};
+        }
+
+        glm::vec3 read_vec3(const nlohmann::json& d, const std::string& key, const glm::vec3& fallback)
+        {
+            if (!d.contains(key)) return fallback;
+            return glm::vec3(d.at(key)[0], d.at(key)[1], d.at(key)[2]);
+        }
+
+        // rotations are given as angle in degrees followed by the rotation axis
+        glm::quat read_rotation(const nlohmann::json& d, const glm::quat& fallback)
+        {
+            if (!d.contains("rotation")) return fallback;
+            return glm::angleAxis(glm::radians(float(d.at("rotation")[0])), glm::normalize(glm::vec3(d.at("rotation")[1], d.at("rotation")[2], d.at("rotation")[3])));
+        }
+
+        glm::mat4 compose_transformation(const glm::vec3& scale, const glm::quat& rotation, const glm::vec3& translation)
+        {
+            glm::mat4 transformation = glm::mat4(glm::mat3(glm::vec3(scale.x, 0.0f, 0.0f), glm::vec3(0.0f, scale.y, 0.0f), glm::vec3(0.0f, 0.0f, scale.z))) * glm::mat4_cast(rotation);
+            transformation[3] = glm::vec4(translation, 1.0f);
+            return transformation;
+        }
+
+        // transformation of a model reference
+        glm::mat4 read_transformation(const nlohmann::json& d)
+        {
+            return compose_transformation(read_vec3(d, "scale", glm::vec3(1.0f)), read_rotation(d, glm::quat(1.0f, 0.0f, 0.0f, 0.0f)), read_vec3(d, "translation", glm::vec3(0.0f)));
+        }
+    } // namespace
+
     Scene::Scene(const VulkanMainContext& vmc, VulkanCommandContext& vcc, Storage& storage) : vmc(vmc), vcc(vcc), storage(storage), path_tracer(vmc, vcc, storage)
     {}
 
@@ -22,13 +146,20 @@ namespace ve
     void Scene::destruct()
     {
         path_tracer.destruct();
-        storage.destroy_buffer(emissive_mesh_indices_buffer);
+        storage.destroy_buffer(emissive_triangle_buffer);
+        for (uint32_t i : model_transforms_buffers) storage.destroy_buffer(i);
+        model_transforms_buffers.clear();
+        model_transforms.clear();
+        animations.clear();
         storage.destroy_buffer(model_mrd_indices_buffer);
         storage.destroy_buffer(mesh_render_data_buffer);
+        storage.destroy_buffer(light_tree_buffer);
         storage.destroy_buffer(light_buffer);
         storage.destroy_buffer(material_buffer);
         storage.destroy_buffer(index_buffer);
-        storage.destroy_buffer(vertex_buffer);
+        storage.destroy_buffer(vertex_color_buffer);
+        storage.destroy_buffer(vertex_attribute_buffer);
+        storage.destroy_buffer(vertex_position_buffer);
         for (uint32_t i : texture_image_indices) storage.destroy_image(i);
         texture_image_indices.clear();
         loaded = false;
@@ -36,114 +167,450 @@ namespace ve
 
     void Scene::load(const std::string& path)
     {
-        ModelLoader::reset();
-        std::vector<Vertex> vertices;
+        using json = nlohmann::json;
+        std::ifstream file(path);
+        std::stringstream file_content;
+        file_content << file.rdbuf();
+        const std::string scene_file_content = file_content.str();
+        json data = json::parse(scene_file_content);
+
+        // the preprocessed scene is cached on disk, only decode models and textures again if the scene or any referenced asset changed
+        const uint64_t hash = SceneCache::compute_hash(scene_file_content, data);
+        const std::string cache_path = std::string("../assets/cache/") + std::filesystem::path(path).stem().string() + ".pdcache";
+        SceneCache cache;
+        if (cache.open(cache_path, hash))
+        {
+            spdlog::info("Loading scene from cache \"{}\"", cache_path);
+        }
+        else
+        {
+            cache.begin(hash);
+            build_cache(data, cache);
+            if (!cache.write(cache_path)) spdlog::warn("Failed to write scene cache \"{}\"", cache_path);
+        }
+        load_animations(data, cache);
+        upload(cache);
+        loaded = true;
+    }
+
+    bool Scene::update(vk::CommandBuffer& cb, float time, uint32_t read_only_image)
+    {
+        if (!apply_animations(time)) return false;
+        transforms_version++;
+        update_transforms(read_only_image);
+        path_tracer.update_tlas(cb, read_only_image);
+        return true;
+    }
+
+    void Scene::update_transforms(uint32_t read_only_image)
+    {
+        if (buffer_transforms_versions[read_only_image] == transforms_version) return;
+        storage.get_buffer(model_transforms_buffers[read_only_image]).update_data(model_transforms);
+        buffer_transforms_versions[read_only_image] = transforms_version;
+    }
+
+    void Scene::load_animations(const nlohmann::json& data, const SceneCache& cache)
+    {
+        // animations are not part of the cache as they only need the json file and the instance ranges of the model references
+        if (!data.contains("model_files")) return;
+        std::span<const ModelReference> model_references = cache.get_section<ModelReference>(SceneCache::MODEL_REFERENCES);
+        std::span<const ModelInfo> model_infos = cache.get_section<ModelInfo>(SceneCache::MODEL_INFOS);
+        const nlohmann::json& model_files = data.at("model_files");
+        for (uint32_t i = 0; i < model_files.size(); ++i)
+        {
+            const nlohmann::json& d = model_files[i];
+            if (!d.contains("animation") || !d.at("animation").contains("keyframes") || d.at("animation").at("keyframes").empty()) continue;
+            // keyframes take missing values from the static transformation of the model reference
+            const glm::vec3 scale = read_vec3(d, "scale", glm::vec3(1.0f));
+            const glm::quat rotation = read_rotation(d, glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+            const glm::vec3 translation = read_vec3(d, "translation", glm::vec3(0.0f));
+            const glm::mat4 inverse_transformation = glm::inverse(compose_transformation(scale, rotation, translation));
+            Animation& animation = animations.emplace_back();
+            animation.loop = d.at("animation").value("loop", true);
+            animation.current_time = -1.0f;
+            for (const auto& k : d.at("animation").at("keyframes"))
+            {
+                animation.keyframes.push_back(Keyframe{k.value("time", 0.0f), read_vec3(k, "scale", scale), read_rotation(k, rotation), read_vec3(k, "translation", translation)});
+            }
+            std::sort(animation.keyframes.begin(), animation.keyframes.end(), [](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+            animation.first_model_info = model_references[i].first_model_info;
+            for (uint32_t j = 0; j < model_references[i].model_info_count; ++j)
+            {
+                animation.local_transformations.push_back(inverse_transformation * model_infos[animation.first_model_info + j].transformation);
+            }
+        }
+    }
+
+    bool Scene::apply_animations(float time)
+    {
+        bool moved = false;
+        for (Animation& animation : animations)
+        {
+            const std::vector<Keyframe>& keyframes = animation.keyframes;
+            const float start = keyframes.front().time;
+            const float duration = keyframes.back().time - start;
+            float t = time;
+            if (animation.loop && duration > 0.0f) t = start + (t - start) - duration * std::floor((t - start) / duration);
+            t = glm::clamp(t, start, keyframes.back().time);
+            if (t == animation.current_time) continue;
+            animation.current_time = t;
+            moved = true;
+
+            uint32_t k = 0;
+            while (k + 2 < keyframes.size() && keyframes[k + 1].time < t) k++;
+            const Keyframe& k0 = keyframes[k];
+            const Keyframe& k1 = keyframes[std::min<std::size_t>(k + 1, keyframes.size() - 1)];
+            const float alpha = k1.time > k0.time ? (t - k0.time) / (k1.time - k0.time) : 0.0f;
+            const glm::mat4 transformation = compose_transformation(glm::mix(k0.scale, k1.scale, alpha), glm::slerp(k0.rotation, k1.rotation, alpha), glm::mix(k0.translation, k1.translation, alpha));
+            for (uint32_t j = 0; j < animation.local_transformations.size(); ++j)
+            {
+                const glm::mat4 object_to_world = transformation * animation.local_transformations[j];
+                path_tracer.update_instance(animation.first_model_info + j, object_to_world);
+                model_transforms[animation.first_model_info + j] = ModelTransform{.object_to_world = object_to_world, .normal_to_world = glm::transpose(glm::inverse(object_to_world))};
+            }
+        }
+        return moved;
+    }
+
+    void Scene::build_cache(const nlohmann::json& data, SceneCache& cache)
+    {
+        std::vector<glm::vec3> vertex_positions;
+        std::vector<VertexAttributes> vertex_attributes;
+        std::vector<uint64_t> vertex_colors;
         std::vector<uint32_t> indices;
         std::vector<Material> materials;
         std::vector<MeshRenderData> mesh_render_data;
-        std::vector<uint32_t> emissive_mesh_indices;
         std::vector<Light> lights;
+        std::vector<TextureData> textures;
+        std::vector<GroupMesh> group_meshes;
+        uint32_t mesh_group_count = 0;
         std::vector<ModelInfo> model_infos;
+        std::vector<ModelReference> model_references;
 
-        auto add_model = [&](Model& model, const std::string& name, const glm::mat4& transformation) -> void
-        {
-            model_infos.push_back({});
-            model_infos.back().index_buffer_idx = indices.size();
-            vertices.insert(vertices.end(), model.vertices.begin(), model.vertices.end());
-            indices.insert(indices.end(), model.indices.begin(), model.indices.end());
-            model_infos.back().num_indices = indices.size() - model_infos.back().index_buffer_idx;
-            materials.insert(materials.end(), model.materials.begin(), model.materials.end());
-            lights.insert(lights.end(), model.lights.begin(), model.lights.end());
-            texture_image_indices.insert(texture_image_indices.end(), model.texture_image_indices.begin(), model.texture_image_indices.end());
-            model_infos.back().mesh_render_data_idx = mesh_render_data.size();
-            for (Mesh& mesh : model.meshes)
-            {
-                mesh_render_data.push_back(MeshRenderData{.mat_idx = mesh.material_idx, .indices_idx = mesh.index_offset, .idx_count = mesh.index_count});
-                model_infos.back().mesh_index_offsets.push_back(mesh.index_offset);
-                model_infos.back().mesh_index_count.push_back(mesh.index_count);
-                if (glm::length(materials[mesh.material_idx].emission) > 0.0 && materials[mesh.material_idx].emission_strength > 0.0)
+        // move geometry, materials and textures of a freshly loaded model into the scene and return the index of its first mesh group
+        // the loader returns model relative indices, so they are offset by everything that is already stored in front
+        auto add_geometry = [&](Model& model) -> uint32_t
+        {
+            const uint32_t vertex_offset = vertex_positions.size();
+            const uint32_t index_offset = indices.size();
+            const uint32_t material_offset = materials.size();
+            const uint32_t texture_offset = textures.size();
+            for (const Vertex& v : model.vertices)
+            {
+                vertex_positions.push_back(v.pos);
+                vertex_attributes.push_back(VertexAttributes{glm::packSnorm2x16(encode_octahedral(v.normal)), glm::packHalf2x16(v.tex)});
+            }
+            for (uint32_t idx : model.indices) indices.push_back(idx + vertex_offset);
+            for (Material m : model.materials)
+            {
+                if (m.base_texture > -1) m.base_texture += texture_offset;
+                materials.push_back(m);
+            }
+            std::move(model.textures.begin(), model.textures.end(), std::back_inserter(textures));
+            const uint32_t first_mesh_group = mesh_group_count;
+            for (std::vector<Mesh>& mesh_group : model.mesh_groups)
+            {
+                for (Mesh& mesh : mesh_group)
                 {
-                    emissive_mesh_indices.push_back(mesh_render_data.size() - 1);
+                    if (mesh.vertex_colors)
+                    {
+                        mesh.color_offset = vertex_colors.size();
+                        for (uint32_t i = 0; i < mesh.vertex_count; ++i) vertex_colors.push_back(glm::packUnorm4x16(model.vertices[mesh.vertex_offset + i].color));
+                    }
+                    mesh.vertex_offset += vertex_offset;
+                    mesh.index_offset += index_offset;
+                    if (mesh.material_idx > -1) mesh.material_idx += material_offset;
+                    group_meshes.push_back(GroupMesh{mesh_group_count, mesh.index_offset, mesh.index_count});
                 }
+                mesh_group_count++;
             }
+            model.vertices.clear();
+            model.indices.clear();
+            model.textures.clear();
+            return first_mesh_group;
         };
 
-        // load scene from custom json file
-        using json = nlohmann::json;
-        std::ifstream file(path);
-        json data = json::parse(file);
-        if (data.contains("model_files"))
+        // reference the mesh groups of a model once more with the given transformation
+        auto add_model = [&](const Model& model, uint32_t first_mesh_group, const glm::mat4& transformation, int32_t material_override) -> void
         {
-            // load referenced model files
-            for (const auto& d : data.at("model_files"))
+            for (const MeshInstance& mesh_instance : model.mesh_instances)
             {
-                const std::string name = d.value("name", "");
-                Model model = ModelLoader::load(vmc, storage, d);
-
-                // apply transformations to model
-                glm::mat4 transformation(1.0f);
-                if (d.contains("scale"))
+                model_infos.push_back({});
+                model_infos.back().transformation = transformation * mesh_instance.transformation;
+                model_infos.back().mesh_group_idx = first_mesh_group + mesh_instance.mesh_group_idx;
+                model_infos.back().mesh_render_data_idx = mesh_render_data.size();
+                for (const Mesh& mesh : model.mesh_groups[mesh_instance.mesh_group_idx])
                 {
-                    transformation[0][0] = d.at("scale")[0];
-                    transformation[1][1] = d.at("scale")[1];
-                    transformation[2][2] = d.at("scale")[2];
+                    const int32_t mat_idx = material_override > -1 ? material_override : mesh.material_idx;
+                    mesh_render_data.push_back(MeshRenderData{.mat_idx = mat_idx, .indices_idx = mesh.index_offset, .idx_count = mesh.index_count, .model_idx = uint32_t(model_infos.size() - 1), .color_offset = mesh.color_offset, .vertex_offset = mesh.vertex_offset});
                 }
-                if (d.contains("rotation"))
+            }
+            for (Light l : model.lights)
+            {
+                l.pos = transformation * glm::vec4(l.pos, 1.0f);
+                l.dir = glm::normalize(glm::vec3(transformation * glm::vec4(l.dir, 0.0f)));
+                lights.push_back(l);
+            }
+        };
+
+        using json = nlohmann::json;
+        // parsing, vertex expansion and texture decoding of all models runs concurrently, every model is assembled into the scene afterwards in the order of the json file
+        // models referencing the same file share their geometry and thereby their blas, so every file is only loaded once
+        // a material from the json file overrides all materials of the model, so these models are loaded separately as the glb materials are never loaded for them
+        const json empty_array = json::array();
+        const json& model_files = data.contains("model_files") ? data.at("model_files") : empty_array;
+        const json& custom_models = data.contains("custom_models") ? data.at("custom_models") : empty_array;
+        std::vector<std::future<Model>> model_files_loads(model_files.size());
+        std::vector<std::future<Model>> custom_models_loads(custom_models.size());
+        std::vector<std::string> keys;
+        {
+            ThreadPool thread_pool;
+            std::unordered_set<std::string> submitted_keys;
+            for (uint32_t i = 0; i < model_files.size(); ++i)
+            {
+                const json& d = model_files[i];
+                keys.push_back(d.value("file", "") + (d.contains("material") ? "|material" : ""));
+                if (submitted_keys.insert(keys.back()).second)
                 {
-                    transformation = glm::rotate(transformation, glm::radians(float(d.at("rotation")[0])), glm::vec3(d.at("rotation")[1], d.at("rotation")[2], d.at("rotation")[3]));
+                    model_files_loads[i] = thread_pool.submit([&d]() { return ModelLoader::load(d); });
                 }
-                if (d.contains("translation"))
+                else if (d.contains("material"))
                 {
-                    transformation[3][0] = d.at("translation")[0];
-                    transformation[3][1] = d.at("translation")[1];
-                    transformation[3][2] = d.at("translation")[2];
+                    model_files_loads[i] = thread_pool.submit([&d]() { Model material_model{}; ModelLoader::load_json_material(d, material_model); return material_model; });
                 }
-                model.apply_transformation(transformation);
-                add_model(model, name, transformation);
             }
+            for (uint32_t i = 0; i < custom_models.size(); ++i)
+            {
+                const json& d = custom_models[i];
+                custom_models_loads[i] = thread_pool.submit([&d]() { return ModelLoader::load_custom(d); });
+            }
+            // destroying the thread pool waits for all loads to finish
         }
-        // load custom models (vertices and indices directly contained in json file)
-        if (data.contains("custom_models"))
+
+        struct CachedModel {
+            Model model;
+            uint32_t first_mesh_group;
+        };
+        std::unordered_map<std::string, CachedModel> model_cache;
+        for (uint32_t i = 0; i < model_files.size(); ++i)
         {
-            for (const auto& d : data["custom_models"])
+            const json& d = model_files[i];
+            int32_t material_override = -1;
+            auto cached = model_cache.find(keys[i]);
+            if (cached == model_cache.end())
+            {
+                Model model = model_files_loads[i].get();
+                const uint32_t first_mesh_group = add_geometry(model);
+                cached = model_cache.emplace(keys[i], CachedModel{std::move(model), first_mesh_group}).first;
+            }
+            else if (d.contains("material"))
             {
-                std::string name = d.value("name", "");
-                Model model = ModelLoader::load_custom(vmc, storage, d);
-                add_model(model, name, glm::mat4(1.0f));
+                // the material model only contains the override material
+                Model material_model = model_files_loads[i].get();
+                material_override = materials.size();
+                add_geometry(material_model);
             }
+
+            const uint32_t first_model_info = model_infos.size();
+            add_model(cached->second.model, cached->second.first_mesh_group, read_transformation(d), material_override);
+            model_references.push_back(ModelReference{first_model_info, uint32_t(model_infos.size() - first_model_info)});
         }
-        vertex_buffer = storage.add_named_buffer(std::string("vertices"), vertices, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
-        index_buffer = storage.add_named_buffer(std::string("indices"), indices, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
-        vk::CommandBuffer& cb = vcc.get_one_time_compute_buffer();
-        for (uint32_t i = 0; i < model_infos.size(); ++i)
+        // custom models (vertices and indices directly contained in json file)
+        for (auto& load : custom_models_loads)
         {
-            ModelInfo& mi = model_infos[i];
-            mi.blas_idx = path_tracer.add_blas(cb, vertex_buffer, index_buffer, mi.mesh_index_offsets, mi.mesh_index_count, sizeof(Vertex));
-            mi.instance_idx = path_tracer.add_instance(mi.blas_idx, glm::mat4(1.0f), i);
+            Model model = load.get();
+            const uint32_t first_mesh_group = add_geometry(model);
+            add_model(model, first_mesh_group, glm::mat4(1.0f), -1);
+        }
+        // lights without power can never contribute, so they are not part of the tree
+        std::vector<uint32_t> light_indices;
+        for (uint32_t i = 0; i < lights.size(); ++i)
+        {
+            if (luminance(lights[i].color) * lights[i].intensity > 0.0f) light_indices.push_back(i);
+        }
+        std::vector<LightTreeNode> light_tree;
+        if (!light_indices.empty())
+        {
+            light_tree.resize(1);
+            build_light_tree(light_tree, 0, lights, light_indices);
         }
-        vcc.submit_compute(cb, true);
         if (materials.empty()) materials.push_back(Material());
-        material_buffer = storage.add_named_buffer(std::string("materials"), materials, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
-        materials.clear();
         if (lights.empty()) lights.push_back(Light());
-        light_buffer = storage.add_named_buffer(std::string("lights"), lights, vk::BufferUsageFlagBits::eStorageBuffer, false, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
-        // delete vertices and indices on host
-        indices.clear();
-        vertices.clear();
-        mesh_render_data_buffer = storage.add_named_buffer("mesh_render_data", mesh_render_data, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
+        if (vertex_colors.empty()) vertex_colors.push_back(0);
+
+        // NEE picks emissive triangles proportional to emitted luminance times world space area
+        std::vector<EmissiveTriangle> emissive_triangles;
+        std::vector<float> emissive_weights;
+        for (uint32_t mrd_idx = 0; mrd_idx < mesh_render_data.size(); ++mrd_idx)
+        {
+            MeshRenderData& mrd = mesh_render_data[mrd_idx];
+            if (mrd.mat_idx < 0) continue;
+            const Material& m = materials[mrd.mat_idx];
+            const float power = luminance(glm::vec3(m.emission)) * m.emission_strength;
+            if (power <= 0.0f) continue;
+            // all triangles of the mesh are stored, so the entry of a triangle hit by a ray can be found by its primitive index
+            mrd.emissive_triangle_offset = emissive_triangles.size();
+            const glm::mat3 object_to_world = glm::mat3(model_infos[mrd.model_idx].transformation);
+            for (uint32_t i = 0; i < mrd.idx_count / 3; ++i)
+            {
+                const uint32_t* triangle = &indices[mrd.indices_idx + i * 3];
+                const glm::vec3 e1 = vertex_positions[triangle[1]] - vertex_positions[triangle[0]];
+                const glm::vec3 e2 = vertex_positions[triangle[2]] - vertex_positions[triangle[0]];
+                const glm::vec3 n = glm::cross(e1, e2);
+                const float area = 0.5f * glm::length(n);
+                // degenerate triangles keep a zero normal and are never picked
+                emissive_triangles.push_back(EmissiveTriangle{.normal = area > 0.0f ? n / (2.0f * area) : glm::vec3(0.0f), .area = area, .mesh_render_data_idx = mrd_idx, .primitive_idx = i});
+                // animations keep the probabilities of the initial transformation, the shader only uses them together with the current area
+                emissive_weights.push_back(power * 0.5f * glm::length(glm::cross(object_to_world * e1, object_to_world * e2)));
+            }
+        }
+        build_alias_table(emissive_triangles, emissive_weights);
+
+        std::vector<TextureInfo> texture_infos;
+        std::vector<unsigned char> texture_data;
+        for (const TextureData& texture : textures)
+        {
+            texture_infos.push_back(TextureInfo{texture.width, texture.height, texture.base_mip_level, 0, texture_data.size()});
+            texture_data.insert(texture_data.end(), texture.pixels.begin(), texture.pixels.end());
+        }
+
+        cache.add_section(SceneCache::VERTEX_POSITIONS, vertex_positions);
+        cache.add_section(SceneCache::VERTEX_ATTRIBUTES, vertex_attributes);
+        cache.add_section(SceneCache::VERTEX_COLORS, vertex_colors);
+        cache.add_section(SceneCache::INDICES, indices);
+        cache.add_section(SceneCache::MATERIALS, materials);
+        cache.add_section(SceneCache::LIGHTS, lights);
+        cache.add_section(SceneCache::MESH_RENDER_DATA, mesh_render_data);
+        cache.add_section(SceneCache::EMISSIVE_TRIANGLES, emissive_triangles);
+        cache.add_section(SceneCache::GROUP_MESHES, group_meshes);
+        cache.add_section(SceneCache::MODEL_INFOS, model_infos);
+        cache.add_section(SceneCache::TEXTURE_INFOS, texture_infos);
+        cache.add_section(SceneCache::TEXTURE_DATA, texture_data);
+        cache.add_section(SceneCache::MODEL_REFERENCES, model_references);
+        cache.add_section(SceneCache::LIGHT_TREE, light_tree);
+    }
+
+    // top down build that splits the lights at the median of their positions along the largest extent
+    void Scene::build_light_tree(std::vector<LightTreeNode>& nodes, uint32_t node_idx, const std::vector<Light>& lights, std::span<uint32_t> light_indices)
+    {
+        if (light_indices.size() == 1)
+        {
+            const Light& light = lights[light_indices[0]];
+            const LightCone cone = get_light_cone(light);
+            // the intensity is used instead of the flux, a narrow spot light is as important as a point light of the same intensity inside of its cone
+            nodes[node_idx] = LightTreeNode{.bounds_min = light.pos, .power = luminance(light.color) * light.intensity, .bounds_max = light.pos, .theta_o = cone.theta_o, .axis = cone.axis, .theta_e = cone.theta_e, .child_or_light = light_indices[0], .leaf = 1};
+            return;
+        }
+        glm::vec3 bounds_min(std::numeric_limits<float>::max());
+        glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+        for (uint32_t i : light_indices)
+        {
+            bounds_min = glm::min(bounds_min, lights[i].pos);
+            bounds_max = glm::max(bounds_max, lights[i].pos);
+        }
+        const glm::vec3 extent = bounds_max - bounds_min;
+        const uint32_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        const std::size_t half = light_indices.size() / 2;
+        std::nth_element(light_indices.begin(), light_indices.begin() + half, light_indices.end(), [&](uint32_t a, uint32_t b) { return lights[a].pos[axis] < lights[b].pos[axis]; });
+        const uint32_t left = nodes.size();
+        nodes.resize(nodes.size() + 2);
+        build_light_tree(nodes, left, lights, light_indices.subspan(0, half));
+        build_light_tree(nodes, left + 1, lights, light_indices.subspan(half));
+        const LightTreeNode& l = nodes[left];
+        const LightTreeNode& r = nodes[left + 1];
+        const LightCone cone = merge_cones(LightCone{l.axis, l.theta_o, l.theta_e}, LightCone{r.axis, r.theta_o, r.theta_e});
+        nodes[node_idx] = LightTreeNode{.bounds_min = glm::min(l.bounds_min, r.bounds_min), .power = l.power + r.power, .bounds_max = glm::max(l.bounds_max, r.bounds_max), .theta_o = cone.theta_o, .axis = cone.axis, .theta_e = cone.theta_e, .child_or_light = left, .leaf = 0};
+    }
+
+    void Scene::upload(const SceneCache& cache)
+    {
+        std::span<const glm::vec3> vertex_positions = cache.get_section<glm::vec3>(SceneCache::VERTEX_POSITIONS);
+        std::span<const VertexAttributes> vertex_attributes = cache.get_section<VertexAttributes>(SceneCache::VERTEX_ATTRIBUTES);
+        std::span<const uint64_t> vertex_colors = cache.get_section<uint64_t>(SceneCache::VERTEX_COLORS);
+        std::span<const uint32_t> indices = cache.get_section<uint32_t>(SceneCache::INDICES);
+        std::span<const GroupMesh> group_meshes = cache.get_section<GroupMesh>(SceneCache::GROUP_MESHES);
+        std::span<const ModelInfo> model_infos = cache.get_section<ModelInfo>(SceneCache::MODEL_INFOS);
+        spdlog::info("Scene contains {} unique meshes referenced by {} instances", group_meshes.empty() ? 0 : group_meshes.back().mesh_group_idx + 1, model_infos.size());
+
+        vertex_position_buffer = storage.add_named_buffer(std::string("vertex_positions"), vertex_positions.data(), vertex_positions.size(), vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        vertex_attribute_buffer = storage.add_named_buffer(std::string("vertex_attributes"), vertex_attributes.data(), vertex_attributes.size(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        vertex_color_buffer = storage.add_named_buffer(std::string("vertex_colors"), vertex_colors.data(), vertex_colors.size(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        index_buffer = storage.add_named_buffer(std::string("indices"), indices.data(), indices.size(), vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute);
+        // meshes of a group are stored consecutively, groups without meshes have no entries and get no blas
+        uint32_t mesh_group_count = 0;
+        for (const GroupMesh& gm : group_meshes) mesh_group_count = std::max(mesh_group_count, gm.mesh_group_idx + 1);
+        for (const ModelInfo& mi : model_infos) mesh_group_count = std::max(mesh_group_count, mi.mesh_group_idx + 1);
+        std::vector<uint32_t> blas_indices(mesh_group_count, PathTraceBuilder::no_blas);
+        for (uint32_t i = 0; i < group_meshes.size();)
+        {
+            std::vector<uint32_t> mesh_index_offsets;
+            std::vector<uint32_t> mesh_index_count;
+            const uint32_t mesh_group_idx = group_meshes[i].mesh_group_idx;
+            for (; i < group_meshes.size() && group_meshes[i].mesh_group_idx == mesh_group_idx; ++i)
+            {
+                mesh_index_offsets.push_back(group_meshes[i].index_offset);
+                mesh_index_count.push_back(group_meshes[i].index_count);
+            }
+            blas_indices[mesh_group_idx] = path_tracer.add_blas(vertex_position_buffer, index_buffer, mesh_index_offsets, mesh_index_count, sizeof(glm::vec3));
+        }
+        path_tracer.build_blas();
         std::vector<uint32_t> model_mrd_indices;
-        for (const auto& model : model_infos) model_mrd_indices.push_back(model.mesh_render_data_idx);
+        for (uint32_t i = 0; i < model_infos.size(); ++i)
+        {
+            const ModelInfo& mi = model_infos[i];
+            path_tracer.add_instance(blas_indices[mi.mesh_group_idx], mi.transformation, i);
+            model_mrd_indices.push_back(mi.mesh_render_data_idx);
+            model_transforms.push_back(ModelTransform{.object_to_world = mi.transformation, .normal_to_world = glm::transpose(glm::inverse(mi.transformation))});
+        }
+        // the tlas is built with the instances at the start of their animations
+        apply_animations(0.0f);
+        std::span<const Material> materials = cache.get_section<Material>(SceneCache::MATERIALS);
+        material_buffer = storage.add_named_buffer(std::string("materials"), materials.data(), materials.size(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
+        std::span<const Light> lights = cache.get_section<Light>(SceneCache::LIGHTS);
+        light_buffer = storage.add_named_buffer(std::string("lights"), lights.data(), lights.size(), vk::BufferUsageFlagBits::eStorageBuffer, false, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
+        std::span<const LightTreeNode> light_tree = cache.get_section<LightTreeNode>(SceneCache::LIGHT_TREE);
+        // a binary tree with n leaves has 2n - 1 nodes
+        punctual_light_count = (light_tree.size() + 1) / 2;
+        const LightTreeNode no_light_tree_node{};
+        light_tree_buffer = storage.add_named_buffer(std::string("light_tree"), light_tree.empty() ? &no_light_tree_node : light_tree.data(), std::max<std::size_t>(light_tree.size(), 1), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
+        std::span<const MeshRenderData> mesh_render_data = cache.get_section<MeshRenderData>(SceneCache::MESH_RENDER_DATA);
+        mesh_render_data_buffer = storage.add_named_buffer("mesh_render_data", mesh_render_data.data(), mesh_render_data.size(), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
         model_mrd_indices_buffer = storage.add_named_buffer("model_mrd_indices", model_mrd_indices, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
-        emissive_mesh_indices_buffer = storage.add_named_buffer("emissive_mesh_indices", emissive_mesh_indices, vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
+        // transformations of animated scenes are rewritten every frame
+        for (uint32_t i = 0; i < frames_in_flight; ++i) model_transforms_buffers.push_back(storage.add_named_buffer("model_transforms_" + std::to_string(i), model_transforms, vk::BufferUsageFlagBits::eStorageBuffer, animations.empty(), vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics));
+        transforms_version = 0;
+        buffer_transforms_versions.fill(0);
+        std::span<const EmissiveTriangle> emissive_triangles = cache.get_section<EmissiveTriangle>(SceneCache::EMISSIVE_TRIANGLES);
+        emissive_triangle_count = emissive_triangles.size();
+        // buffers can not be empty, the shader skips NEE for scenes without emissive triangles
+        const EmissiveTriangle no_emissive_triangle{};
+        emissive_triangle_buffer = storage.add_named_buffer("emissive_triangles", emissive_triangles.empty() ? &no_emissive_triangle : emissive_triangles.data(), std::max<std::size_t>(emissive_triangles.size(), 1), vk::BufferUsageFlagBits::eStorageBuffer, true, vmc.queue_family_indices.transfer, vmc.queue_family_indices.graphics);
 
-        std::vector<unsigned char> texture_data(4, 0);
-        texture_image_indices.push_back(storage.add_named_image("texture_" + std::to_string(texture_image_indices.size()), texture_data.data(), 1, 1, true, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled));
-
-        loaded = true;
+        // textures are stored as decoded level 0 pixels, mip maps are generated on the gpu
+        std::span<const TextureInfo> texture_infos = cache.get_section<TextureInfo>(SceneCache::TEXTURE_INFOS);
+        std::span<const unsigned char> texture_data = cache.get_section<unsigned char>(SceneCache::TEXTURE_DATA);
+        for (const TextureInfo& ti : texture_infos)
+        {
+            texture_image_indices.push_back(storage.add_named_image("texture_" + std::to_string(texture_image_indices.size()), texture_data.data() + ti.data_offset, ti.width, ti.height, true, ti.base_mip_level, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled));
+        }
+        std::vector<unsigned char> dummy_texture_data(4, 0);
+        texture_image_indices.push_back(storage.add_named_image("texture_" + std::to_string(texture_image_indices.size()), dummy_texture_data.data(), 1, 1, true, 0, std::vector<uint32_t>{vmc.queue_family_indices.graphics, vmc.queue_family_indices.compute, vmc.queue_family_indices.transfer}, vk::ImageUsageFlagBits::eSampled));
+        // the mip maps of all textures are generated with one submission
+        vcc.flush_graphics_batch();
     }
 
     uint32_t Scene::get_texture_image_count() const
     {
         return texture_image_indices.size();
     }
+
+    uint32_t Scene::get_emissive_triangle_count() const
+    {
+        return emissive_triangle_count;
+    }
+
+    uint32_t Scene::get_punctual_light_count() const
+    {
+        return punctual_light_count;
+    }
 } // namespace ve
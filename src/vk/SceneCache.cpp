@@ -0,0 +1,156 @@
+#include "vk/SceneCache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ve_log.hpp"
+
+namespace ve
+{
+    namespace
+    {
+        // 64 bit FNV-1a
+        void hash_bytes(uint64_t& hash, const void* data, std::size_t byte_size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (std::size_t i = 0; i < byte_size; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3;
+            }
+        }
+
+        void hash_file_stamp(uint64_t& hash, const std::string& path)
+        {
+            hash_bytes(hash, path.data(), path.size());
+            std::error_code ec;
+            const uint64_t size = std::filesystem::file_size(path, ec);
+            if (ec) return;
+            const int64_t time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+            hash_bytes(hash, &size, sizeof(size));
+            hash_bytes(hash, &time, sizeof(time));
+        }
+
+        void hash_material_textures(uint64_t& hash, const nlohmann::json& model)
+        {
+            if (!model.contains("material") || !model.at("material").contains("base_texture")) return;
+            hash_file_stamp(hash, std::string("../assets/textures/") + std::string(model.at("material").value("base_texture", "")));
+        }
+    } // namespace
+
+    SceneCache::~SceneCache()
+    {
+        close();
+    }
+
+    uint64_t SceneCache::compute_hash(const std::string& scene_file_content, const nlohmann::json& scene)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        hash_bytes(hash, &version, sizeof(version));
+        hash_bytes(hash, scene_file_content.data(), scene_file_content.size());
+        // hashing the full content of the referenced assets would cost almost as much as loading them, so only their size and modification time is used
+        if (scene.contains("model_files"))
+        {
+            for (const auto& d : scene.at("model_files"))
+            {
+                hash_file_stamp(hash, std::string("../assets/models/") + std::string(d.value("file", "")));
+                hash_material_textures(hash, d);
+            }
+        }
+        if (scene.contains("custom_models"))
+        {
+            for (const auto& d : scene.at("custom_models")) hash_material_textures(hash, d);
+        }
+        return hash;
+    }
+
+    bool SceneCache::open(const std::string& path, uint64_t hash)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header))
+        {
+            ::close(fd);
+            return false;
+        }
+        mapping_size = st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            mapping_size = 0;
+            return false;
+        }
+        const Header* header = static_cast<const Header*>(mapping);
+        bool valid = header->magic == magic && header->version == version && header->section_count == SECTION_COUNT && header->hash == hash;
+        for (uint32_t i = 0; valid && i < SECTION_COUNT; ++i)
+        {
+            valid = header->sections[i].offset + header->sections[i].byte_size <= mapping_size;
+        }
+        if (!valid)
+        {
+            spdlog::info("Scene cache \"{}\" is outdated", path);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void SceneCache::begin(uint64_t hash)
+    {
+        close();
+        memory.resize(sizeof(Header));
+        Header header{};
+        header.magic = magic;
+        header.version = version;
+        header.section_count = SECTION_COUNT;
+        header.hash = hash;
+        std::memcpy(memory.data(), &header, sizeof(Header));
+    }
+
+    void SceneCache::add_section(Section section, const void* data, std::size_t byte_size)
+    {
+        VE_ASSERT(!memory.empty(), "Scene cache needs to be started before adding sections!");
+        const std::size_t offset = (memory.size() + 15) & ~std::size_t(15);
+        memory.resize(offset + byte_size);
+        if (byte_size > 0) std::memcpy(memory.data() + offset, data, byte_size);
+        Header* header = reinterpret_cast<Header*>(memory.data());
+        header->sections[section].offset = offset;
+        header->sections[section].byte_size = byte_size;
+    }
+
+    bool SceneCache::write(const std::string& path) const
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        // write to a temporary file first to never leave a partially written cache behind
+        const std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!file.write(reinterpret_cast<const char*>(memory.data()), memory.size())) return false;
+        }
+        std::filesystem::rename(tmp_path, path, ec);
+        return !ec;
+    }
+
+    void SceneCache::close()
+    {
+        if (mapping) munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+        memory.clear();
+    }
+
+    const std::byte* SceneCache::get_data() const
+    {
+        return mapping ? static_cast<const std::byte*>(mapping) : memory.data();
+    }
+} // namespace ve
@@ -1,13 +1,40 @@
 #include "vk/Shader.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <filesystem>
 #include <iostream>
+#include <regex>
+#include <sstream>
 
 #include "ve_log.hpp"
 
 namespace ve
 {
+    namespace
+    {
+        // 64 bit FNV-1a over the shader and all files it includes
+        void hash_shader_source(uint64_t& hash, const std::filesystem::path& path, std::vector<std::filesystem::path>& visited)
+        {
+            if (std::find(visited.begin(), visited.end(), path) != visited.end()) return;
+            visited.push_back(path);
+            std::ifstream file(path, std::ios::binary);
+            std::ostringstream file_stream;
+            file_stream << file.rdbuf();
+            const std::string source = file_stream.str();
+            for (unsigned char c : source)
+            {
+                hash ^= c;
+                hash *= 0x100000001b3;
+            }
+            const std::regex include_regex("#include\\s*\"([^\"]+)\"");
+            for (auto it = std::sregex_iterator(source.begin(), source.end(), include_regex); it != std::sregex_iterator(); ++it)
+            {
+                hash_shader_source(hash, (path.parent_path() / (*it)[1].str()).lexically_normal(), visited);
+            }
+        }
+    } // namespace
+
     Shader::Shader(const vk::Device& device, const std::string filename, vk::ShaderStageFlagBits shader_stage_flag) : name(filename), device(device)
     {
         std::filesystem::path shader_dir("../shader/");
@@ -15,9 +42,20 @@ namespace ve
         if (!std::filesystem::exists(shader_bin_dir)) std::filesystem::create_directory(shader_bin_dir);
         std::filesystem::path shader_file(shader_dir / filename);
         std::filesystem::path shader_bin_file(shader_bin_dir / (filename + ".spv"));
+        std::filesystem::path shader_hash_file(shader_bin_dir / (filename + ".hash"));
         spdlog::debug("Loading shader \"{}\"", filename);
         VE_ASSERT(std::filesystem::exists(shader_file), "Failed to find shader file \"{}\"", filename);
-        system(std::format("glslc --target-env=vulkan1.2 -O -o {0} {1}", shader_bin_file.string(), shader_file.string()).c_str());
+        // shaders are compiled at build time, only compile again if the source or one of its includes changed since then
+        uint64_t hash = 0xcbf29ce484222325;
+        std::vector<std::filesystem::path> sources;
+        hash_shader_source(hash, shader_file, sources);
+        if (!is_up_to_date(shader_bin_file, shader_hash_file, hash, sources))
+        {
+            spdlog::info("Compiling shader \"{}\"", filename);
+            const int result = system(std::format("glslc --target-env=vulkan1.2 -O -o {0} {1}", shader_bin_file.string(), shader_file.string()).c_str());
+            if (result == 0) std::ofstream(shader_hash_file) << hash;
+            else std::filesystem::remove(shader_hash_file);
+        }
         std::string source = read_shader_file(shader_bin_file);
         vk::ShaderModuleCreateInfo smci{};
         smci.sType = vk::StructureType::eShaderModuleCreateInfo;
@@ -46,6 +84,24 @@ namespace ve
         return pssci;
     }
 
+    bool Shader::is_up_to_date(const std::filesystem::path& bin_file, const std::filesystem::path& hash_file, uint64_t hash, const std::vector<std::filesystem::path>& sources)
+    {
+        if (!std::filesystem::exists(bin_file)) return false;
+        std::ifstream file(hash_file);
+        uint64_t stored_hash;
+        if (file >> stored_hash) return stored_hash == hash;
+        // binaries from the build do not come with a hash, they are valid if they are newer than all sources
+        std::error_code ec;
+        const auto bin_time = std::filesystem::last_write_time(bin_file, ec);
+        for (const auto& source : sources)
+        {
+            if (ec || std::filesystem::last_write_time(source, ec) > bin_time) return false;
+        }
+        if (ec) return false;
+        std::ofstream(hash_file) << hash;
+        return true;
+    }
+
     std::string Shader::read_shader_file(const std::string& filename)
     {
         std::ifstream file(filename, std::ios::binary);
@@ -50,4 +50,33 @@ namespace ve
     {
         device.resetFences(fences[name]);
     }
+
+    TimelineSemaphore::TimelineSemaphore(const vk::Device& logical_device) : device(logical_device)
+    {
+        vk::SemaphoreTypeCreateInfo stci(vk::SemaphoreType::eTimeline, 0);
+        vk::SemaphoreCreateInfo sci{};
+        sci.pNext = &stci;
+        semaphore = device.createSemaphore(sci);
+    }
+
+    void TimelineSemaphore::destruct()
+    {
+        device.destroy(semaphore);
+    }
+
+    const vk::Semaphore& TimelineSemaphore::get() const
+    {
+        return semaphore;
+    }
+
+    uint64_t TimelineSemaphore::get_value() const
+    {
+        return device.getSemaphoreCounterValue(semaphore);
+    }
+
+    void TimelineSemaphore::wait(uint64_t value) const
+    {
+        vk::SemaphoreWaitInfo swi({}, 1, &semaphore, &value);
+        VE_CHECK(device.waitSemaphores(swi, uint64_t(-1)), "Failed to wait for timeline semaphore!");
+    }
 } // namespace ve
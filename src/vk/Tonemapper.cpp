@@ -0,0 +1,75 @@
+#include "vk/Tonemapper.hpp"
+
+namespace ve
+{
+    Tonemapper::Tonemapper(const VulkanMainContext& vmc, Storage& storage) : vmc(vmc), storage(storage), pipeline(vmc), dsh(vmc, display_image_count)
+    {}
+
+    void Tonemapper::construct()
+    {
+        create_descriptor_set();
+        create_pipeline();
+    }
+
+    void Tonemapper::destruct()
+    {
+        pipeline.destruct();
+        dsh.destruct();
+    }
+
+    void Tonemapper::reload_shaders()
+    {
+        pipeline.destruct();
+        create_pipeline();
+    }
+
+    void Tonemapper::compute(vk::CommandBuffer& cb, const AppState& app_state, uint32_t image_idx)
+    {
+        // the path tracer has to finish accumulating before its result is read
+        const vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+        cb.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.get());
+        cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.get_layout(), 0, dsh.get_sets()[image_idx], {});
+        // the debug views are shown as they are
+        const bool debug_view = app_state.attenuation_view || app_state.emission_view || app_state.normal_view || app_state.tex_view;
+        tpc.exposure = debug_view ? 1.0f : app_state.cam.data.exposure;
+        tpc.tonemap_operator = debug_view ? 0 : app_state.tonemap_operator;
+        tpc.viewport_width = app_state.trace_extent.width;
+        tpc.viewport_height = app_state.trace_extent.height;
+        tpc.half_precision_accumulation = app_state.half_precision_accumulation;
+        tpc.path_depth_view = app_state.path_depth_view;
+        cb.pushConstants(pipeline.get_layout(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(TonemapPushConstants), &tpc);
+        cb.dispatch((app_state.trace_extent.width + 31) / 32, (app_state.trace_extent.height + 31) / 32, 1);
+    }
+
+    void Tonemapper::update_descriptors()
+    {
+        dsh.reset_descriptors();
+        add_descriptors();
+        dsh.update();
+    }
+
+    void Tonemapper::create_pipeline()
+    {
+        pipeline.construct(dsh.get_layouts()[0], ShaderInfo{"tonemap.comp", vk::ShaderStageFlagBits::eCompute}, sizeof(TonemapPushConstants));
+    }
+
+    void Tonemapper::create_descriptor_set()
+    {
+        dsh.add_binding(0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute);
+        dsh.add_binding(1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1, vk::DescriptorBindingFlagBits::ePartiallyBound);
+        dsh.add_binding(2, vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute);
+        add_descriptors();
+        dsh.construct();
+    }
+
+    void Tonemapper::add_descriptors()
+    {
+        for (uint32_t i = 0; i < display_image_count; ++i)
+        {
+            dsh.add_descriptor(i, 0, storage.get_buffer_by_name("accumulation_buffer"));
+            if (storage.has_buffer("path_depth_buffer")) dsh.add_descriptor(i, 1, storage.get_buffer_by_name("path_depth_buffer"));
+            dsh.add_descriptor(i, 2, storage.get_image_by_name("path_trace_image_" + std::to_string(i)));
+        }
+    }
+} // namespace ve
@@ -1,5 +1,7 @@
 #include "vk/VulkanCommandContext.hpp"
 
+#include <cstring>
+
 #include "ve_log.hpp"
 
 namespace ve
@@ -15,11 +17,38 @@ namespace ve
         one_time_cbs[GRAPHICS] = command_pools[GRAPHICS].create_command_buffers(1)[0];
         one_time_cbs[COMPUTE] = command_pools[COMPUTE].create_command_buffers(1)[0];
         one_time_cbs[TRANSFER] = command_pools[TRANSFER].create_command_buffers(1)[0];
+        graphics_batch_cb = command_pools[GRAPHICS].create_command_buffers(1)[0];
+
+        vk::SemaphoreTypeCreateInfo stci(vk::SemaphoreType::eTimeline, 0);
+        vk::SemaphoreCreateInfo sci{};
+        sci.pNext = &stci;
+        upload_semaphore = vmc.logical_device.get().createSemaphore(sci);
+        upload_cbs = command_pools[TRANSFER].create_command_buffers(upload_cb_count);
+        upload_cb_values.assign(upload_cb_count, 0);
+
+        vk::BufferCreateInfo bci{};
+        bci.sType = vk::StructureType::eBufferCreateInfo;
+        bci.size = staging_chunk_size * staging_chunk_count;
+        bci.usage = vk::BufferUsageFlagBits::eTransferSrc;
+        bci.sharingMode = vk::SharingMode::eExclusive;
+        VmaAllocationCreateInfo vaci{};
+        vaci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+        vaci.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        VkBuffer buffer;
+        VmaAllocationInfo vai;
+        vmaCreateBuffer(vmc.va, (VkBufferCreateInfo*) (&bci), &vaci, &buffer, &staging_vmaa, &vai);
+        staging_buffer = buffer;
+        staging_data = static_cast<std::byte*>(vai.pMappedData);
+        staging_chunk_values.assign(staging_chunk_count, 0);
         spdlog::info("Created VulkanCommandContext");
     }
 
     void VulkanCommandContext::destruct()
     {
+        flush_graphics_batch();
+        wait_for_uploads();
+        vmaDestroyBuffer(vmc.va, staging_buffer, staging_vmaa);
+        vmc.logical_device.get().destroySemaphore(upload_semaphore);
         for (auto& command_pool : command_pools) command_pool.destruct();
         command_pools.clear();
         spdlog::info("Destroyed VulkanCommandContext");
@@ -49,39 +78,164 @@ namespace ve
 
     vk::CommandBuffer& VulkanCommandContext::get_one_time_transfer_buffer() { return begin(one_time_cbs[TRANSFER]); }
 
-    vk::CommandBuffer& VulkanCommandContext::begin(vk::CommandBuffer& cb)
+    vk::CommandBuffer& VulkanCommandContext::begin(vk::CommandBuffer& cb, vk::CommandBufferUsageFlags flags)
     {
         vk::CommandBufferBeginInfo cbbi{};
         cbbi.sType = vk::StructureType::eCommandBufferBeginInfo;
-        cbbi.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        cbbi.flags = flags;
         cb.begin(cbbi);
         return cb;
     }
 
-    void VulkanCommandContext::submit_graphics(const vk::CommandBuffer& cb, bool wait_idle) const
+    void VulkanCommandContext::submit_graphics(const vk::CommandBuffer& cb, bool wait_idle)
     {
         submit(cb, vmc.get_graphics_queue(), wait_idle);
     }
 
-    void VulkanCommandContext::submit_compute(const vk::CommandBuffer& cb, bool wait_idle) const
+    void VulkanCommandContext::submit_compute(const vk::CommandBuffer& cb, bool wait_idle)
     {
         submit(cb, vmc.get_compute_queue(), wait_idle);
     }
 
-    void VulkanCommandContext::submit_transfer(const vk::CommandBuffer& cb, bool wait_idle) const
+    void VulkanCommandContext::submit_transfer(const vk::CommandBuffer& cb, bool wait_idle)
     {
         submit(cb, vmc.get_transfer_queue(), wait_idle);
     }
 
-    void VulkanCommandContext::submit(const vk::CommandBuffer& cb, const vk::Queue& queue, bool wait_idle) const
+    void VulkanCommandContext::submit(const vk::CommandBuffer& cb, const vk::Queue& queue, bool wait_idle)
     {
+        // the following work may read resources written by the batch
+        flush_graphics_batch();
         cb.end();
+        const uint64_t wait_value = flush_uploads();
+        const vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+        vk::TimelineSemaphoreSubmitInfo tssi(1, &wait_value, 0, nullptr);
         vk::SubmitInfo submit_info{};
         submit_info.sType = vk::StructureType::eSubmitInfo;
+        submit_info.pNext = &tssi;
+        submit_info.waitSemaphoreCount = 1;
+        submit_info.pWaitSemaphores = &upload_semaphore;
+        submit_info.pWaitDstStageMask = &wait_stage;
         submit_info.commandBufferCount = 1;
         submit_info.pCommandBuffers = &cb;
         queue.submit(submit_info);
         if (wait_idle) queue.waitIdle();
         cb.reset();
     }
+
+    vk::CommandBuffer& VulkanCommandContext::get_graphics_batch_buffer()
+    {
+        if (!graphics_batch_recording)
+        {
+            begin(graphics_batch_cb);
+            graphics_batch_recording = true;
+        }
+        return graphics_batch_cb;
+    }
+
+    void VulkanCommandContext::destroy_after_graphics_batch(vk::Image image, VmaAllocation vmaa)
+    {
+        VE_ASSERT(graphics_batch_recording, "No graphics batch is recorded!");
+        graphics_batch_images.emplace_back(image, vmaa);
+    }
+
+    void VulkanCommandContext::flush_graphics_batch()
+    {
+        if (!graphics_batch_recording) return;
+        // reset before submitting as submit() flushes the batch itself
+        graphics_batch_recording = false;
+        submit(graphics_batch_cb, vmc.get_graphics_queue(), true);
+        for (auto& [image, vmaa] : graphics_batch_images) vmaDestroyImage(vmc.va, VkImage(image), vmaa);
+        graphics_batch_images.clear();
+    }
+
+    VulkanCommandContext::StagingAllocation VulkanCommandContext::allocate_staging(vk::DeviceSize byte_size)
+    {
+        VE_ASSERT(byte_size <= staging_chunk_size, "Staging allocation is larger than a staging chunk!");
+        // copies from the staging buffer need to be aligned for all texel formats
+        staging_offset = (staging_offset + 15) & ~vk::DeviceSize(15);
+        if (staging_offset + byte_size > staging_chunk_size)
+        {
+            // the current chunk is handed over to the gpu and the next one is reused once the gpu finished reading from it
+            staging_chunk_values[staging_chunk] = flush_uploads();
+            staging_chunk = (staging_chunk + 1) % staging_chunk_count;
+            wait_for_upload_value(staging_chunk_values[staging_chunk]);
+            staging_offset = 0;
+        }
+        const vk::DeviceSize offset = staging_chunk * staging_chunk_size + staging_offset;
+        staging_offset += byte_size;
+        // the chunk is read by the next flush at the earliest
+        staging_chunk_values[staging_chunk] = upload_value + 1;
+        return StagingAllocation{staging_buffer, offset, staging_data + offset};
+    }
+
+    vk::CommandBuffer& VulkanCommandContext::get_upload_buffer()
+    {
+        if (!upload_recording)
+        {
+            wait_for_upload_value(upload_cb_values[upload_cb_idx]);
+            begin(upload_cbs[upload_cb_idx]);
+            // order the copies after the ones of earlier upload submissions that might target the same memory
+            vk::MemoryBarrier mb(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferWrite);
+            upload_cbs[upload_cb_idx].pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, mb, {}, {});
+            upload_recording = true;
+        }
+        return upload_cbs[upload_cb_idx];
+    }
+
+    void VulkanCommandContext::upload_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize byte_size)
+    {
+        // large uploads are split so that they fit into the staging chunks
+        for (vk::DeviceSize offset = 0; offset < byte_size; offset += staging_chunk_size)
+        {
+            const vk::DeviceSize size = std::min(staging_chunk_size, byte_size - offset);
+            StagingAllocation staging = allocate_staging(size);
+            std::memcpy(staging.data, static_cast<const std::byte*>(data) + offset, size);
+            get_upload_buffer().copyBuffer(staging.buffer, dst, vk::BufferCopy(staging.offset, dst_offset + offset, size));
+        }
+    }
+
+    void VulkanCommandContext::fill_buffer(vk::Buffer dst, vk::DeviceSize dst_offset, int constant, vk::DeviceSize byte_size)
+    {
+        for (vk::DeviceSize offset = 0; offset < byte_size; offset += staging_chunk_size)
+        {
+            const vk::DeviceSize size = std::min(staging_chunk_size, byte_size - offset);
+            StagingAllocation staging = allocate_staging(size);
+            std::memset(staging.data, constant, size);
+            get_upload_buffer().copyBuffer(staging.buffer, dst, vk::BufferCopy(staging.offset, dst_offset + offset, size));
+        }
+    }
+
+    uint64_t VulkanCommandContext::flush_uploads()
+    {
+        if (!upload_recording) return upload_value;
+        vk::CommandBuffer& cb = upload_cbs[upload_cb_idx];
+        cb.end();
+        upload_value++;
+        vk::TimelineSemaphoreSubmitInfo tssi(0, nullptr, 1, &upload_value);
+        vk::SubmitInfo submit_info{};
+        submit_info.sType = vk::StructureType::eSubmitInfo;
+        submit_info.pNext = &tssi;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cb;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &upload_semaphore;
+        vmc.get_transfer_queue().submit(submit_info);
+        upload_cb_values[upload_cb_idx] = upload_value;
+        upload_cb_idx = (upload_cb_idx + 1) % upload_cb_count;
+        upload_recording = false;
+        return upload_value;
+    }
+
+    void VulkanCommandContext::wait_for_uploads()
+    {
+        wait_for_upload_value(flush_uploads());
+    }
+
+    void VulkanCommandContext::wait_for_upload_value(uint64_t value) const
+    {
+        if (value == 0) return;
+        vk::SemaphoreWaitInfo swi({}, 1, &upload_semaphore, &value);
+        VE_CHECK(vmc.logical_device.get().waitSemaphores(swi, uint64_t(-1)), "Failed to wait for uploads!");
+    }
 } // namespace ve
@@ -1,11 +1,40 @@
 #include "vk/VulkanMainContext.hpp"
 
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
 #include "ve_log.hpp"
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
 
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
+namespace
+{
+    const std::string pipeline_cache_path = "../assets/cache/pipeline.cache";
+
+    // the cache data is only valid for the exact device and driver it was created with
+    struct PipelineCacheHeader {
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint32_t driver_version;
+        uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+        uint64_t data_size;
+    };
+
+    PipelineCacheHeader get_pipeline_cache_header(const vk::PhysicalDevice& physical_device)
+    {
+        const vk::PhysicalDeviceProperties properties = physical_device.getProperties();
+        PipelineCacheHeader header{};
+        header.vendor_id = properties.vendorID;
+        header.device_id = properties.deviceID;
+        header.driver_version = properties.driverVersion;
+        std::memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+        return header;
+    }
+} // namespace
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity, VkDebugUtilsMessageTypeFlagsEXT message_type, const VkDebugUtilsMessengerCallbackDataEXT* callback_data, void* user_data)
 {
     switch (message_severity)
@@ -40,6 +69,7 @@ namespace ve
         logical_device.construct(physical_device, queue_family_indices, queues);
         create_vma_allocator();
         setup_debug_messenger();
+        create_pipeline_cache();
         spdlog::info("Created VulkanMainContext");
     }
 
@@ -52,11 +82,14 @@ namespace ve
         logical_device.construct(physical_device, queue_family_indices, queues);
         create_vma_allocator();
         setup_debug_messenger();
+        create_pipeline_cache();
         spdlog::info("Created VulkanMainContext");
     }
 
     void VulkanMainContext::destruct()
     {
+        save_pipeline_cache();
+        logical_device.get().destroyPipelineCache(pipeline_cache);
         vmaDestroyAllocator(va);
         if (surface.has_value()) instance.get().destroySurfaceKHR(surface.value());
         logical_device.destruct();
@@ -116,6 +149,44 @@ namespace ve
         vmaCreateAllocator(&vaci, &va);
     }
 
+    void VulkanMainContext::create_pipeline_cache()
+    {
+        const PipelineCacheHeader expected_header = get_pipeline_cache_header(physical_device.get());
+        std::vector<char> data;
+        std::ifstream file(pipeline_cache_path, std::ios::binary);
+        PipelineCacheHeader header;
+        if (file.read(reinterpret_cast<char*>(&header), sizeof(PipelineCacheHeader)))
+        {
+            if (header.vendor_id == expected_header.vendor_id && header.device_id == expected_header.device_id && header.driver_version == expected_header.driver_version && std::memcmp(header.pipeline_cache_uuid, expected_header.pipeline_cache_uuid, VK_UUID_SIZE) == 0)
+            {
+                data.resize(header.data_size);
+                if (!file.read(data.data(), data.size())) data.clear();
+            }
+            else
+            {
+                spdlog::info("Pipeline cache belongs to a different device or driver, starting with an empty cache");
+            }
+        }
+        vk::PipelineCacheCreateInfo pcci{};
+        pcci.sType = vk::StructureType::ePipelineCacheCreateInfo;
+        pcci.initialDataSize = data.size();
+        pcci.pInitialData = data.data();
+        pipeline_cache = logical_device.get().createPipelineCache(pcci);
+    }
+
+    void VulkanMainContext::save_pipeline_cache()
+    {
+        const std::vector<uint8_t> data = logical_device.get().getPipelineCacheData(pipeline_cache);
+        PipelineCacheHeader header = get_pipeline_cache_header(physical_device.get());
+        header.data_size = data.size();
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(pipeline_cache_path).parent_path(), ec);
+        std::ofstream file(pipeline_cache_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(PipelineCacheHeader));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file) spdlog::warn("Failed to write pipeline cache \"{}\"", pipeline_cache_path);
+    }
+
     void VulkanMainContext::setup_debug_messenger()
     {
         vk::DebugUtilsMessengerCreateInfoEXT dumci;